@@ -0,0 +1,97 @@
+#include "Additive.h"
+#include <cmath>
+#include <algorithm>
+#include "Synth.h"
+#include "FastMath.h"
+
+namespace Additive {
+	constexpr float PI = 3.14159265358979f;
+	// Samples evaluated side by side so the partial loop vectorizes
+	constexpr int CHUNK = 64;
+
+	/* Fill in the Fourier series of the enabled waveforms, matching the
+	   mix levels of Synth's oscillators. The sine is spread across the
+	   partials with the same falloff as 'harm', and every partial is
+	   modulated by the harmonic offset sweep. */
+	void computeSpectrum(Spectrum & spectrum, unsigned char waveforms,
+		float duty, float harmonicOffset, int partials) {
+		spectrum.hasCosines = (waveforms & (Synth::SQUARE | Synth::TRIANGLE)) != 0;
+		float vol = 1.0f;
+		for (int i = 0; i < partials; i++) {
+			const int k = i + 1;
+			float sine = 0.0f, cosine = 0.0f;
+			if (waveforms & Synth::SINE) {
+				sine += vol;
+			}
+			if (waveforms & Synth::SQUARE) {
+				const float a = 2.0f / (k * PI) * 0.25f;
+				sine += a * (1.0f - FastMath::cosPoly(2.0f * PI * k * duty));
+				cosine += a * FastMath::sinPoly(2.0f * PI * k * duty);
+			}
+			if (waveforms & Synth::SAWTOOTH) {
+				sine -= 2.0f / (k * PI) * 0.3f;
+			}
+			if ((waveforms & Synth::TRIANGLE) && k % 2 == 1) {
+				cosine -= 8.0f / (PI * PI * k * k) * 0.6f;
+			}
+			const float mod = FastMath::cosPoly(i * harmonicOffset + i);
+			spectrum.sines[i] = sine * mod;
+			spectrum.cosines[i] = cosine * mod;
+			vol *= 0.75f;
+		}
+	}
+
+	/* Number of partials of a voice at freq (Hz) that can be played
+	   without aliasing. */
+	int partialsBelowNyquist(float freq, int partials) {
+		if (freq <= 0.0f) return 0;
+		const int limit = (int)(Synth::SAMPLE_RATE / 2.0f / freq);
+		return std::min(partials, limit);
+	}
+
+	/* Add one voice's partials into out, starting at phase (radians) and
+	   advancing phaseInc per sample. Each sample is a Clenshaw sum over
+	   the partials, so only one sin/cos is needed per sample. */
+	void render(float * out, int length, float phase, float phaseInc,
+		const Spectrum & spectrum, int partials) {
+		if (partials <= 0) return;
+
+		float c[CHUNK], c2[CHUNK], s[CHUNK];
+		float sb1[CHUNK], sb2[CHUNK], cb1[CHUNK], cb2[CHUNK];
+		for (int start = 0; start < length; start += CHUNK) {
+			const int n = std::min(CHUNK, length - start);
+			for (int i = 0; i < n; i++) {
+				const float x = phase + (start + i) * phaseInc;
+				c[i] = FastMath::cosPoly(x);
+				s[i] = FastMath::sinPoly(x);
+				c2[i] = 2.0f * c[i];
+				sb1[i] = sb2[i] = cb1[i] = cb2[i] = 0.0f;
+			}
+
+			for (int k = partials - 1; k >= 0; k--) {
+				const float a = spectrum.sines[k];
+				for (int i = 0; i < n; i++) {
+					const float b = a + c2[i] * sb1[i] - sb2[i];
+					sb2[i] = sb1[i];
+					sb1[i] = b;
+				}
+			}
+			for (int i = 0; i < n; i++) {
+				out[start + i] += sb1[i] * s[i];
+			}
+
+			if (!spectrum.hasCosines) continue;
+			for (int k = partials - 1; k >= 0; k--) {
+				const float a = spectrum.cosines[k];
+				for (int i = 0; i < n; i++) {
+					const float b = a + c2[i] * cb1[i] - cb2[i];
+					cb2[i] = cb1[i];
+					cb1[i] = b;
+				}
+			}
+			for (int i = 0; i < n; i++) {
+				out[start + i] += c[i] * cb1[i] - cb2[i];
+			}
+		}
+	}
+}
@@ -0,0 +1,22 @@
+#ifndef ADDITIVE_H
+#define ADDITIVE_H
+
+namespace Additive {
+	constexpr int MAX_PARTIALS = 256;
+
+	/* Per-partial amplitudes of a band-limited voice. Partial k (1-based)
+	   is stored at index k - 1 as a sine and a cosine component. */
+	struct Spectrum {
+		float sines[MAX_PARTIALS];
+		float cosines[MAX_PARTIALS];
+		bool hasCosines = false;
+	};
+
+	void computeSpectrum(Spectrum & spectrum, unsigned char waveforms,
+		float duty, float harmonicOffset, int partials);
+	int partialsBelowNyquist(float freq, int partials);
+	void render(float * out, int length, float phase, float phaseInc,
+		const Spectrum & spectrum, int partials);
+}
+
+#endif // ADDITIVE_H
@@ -1,5 +1,6 @@
 #include "Chord.h"
 #include <assert.h>
+#include <cstring>
 #include "Notes.h" 
 
 /* Return the correct third (major or minor) given the chord. */
@@ -42,6 +43,58 @@ std::string Chord::name() const {
 	return Notes::name(root) + type + over;
 }
 
+/* Read a note name at text[i], advancing i. Either accidental is
+   accepted on any note. */
+static bool parseNote(const char * text, size_t length, size_t & i, int & chroma) {
+	static const int LETTERS[] = { 9, 11, 0, 2, 4, 5, 7 };
+	if (i >= length || text[i] < 'A' || text[i] > 'G') return false;
+	chroma = LETTERS[text[i++] - 'A'];
+	if (i < length && text[i] == '#') {
+		chroma++;
+		i++;
+	}
+	else if (i < length && text[i] == 'b') {
+		chroma--;
+		i++;
+	}
+	chroma = (chroma + 12) % 12;
+	return true;
+}
+
+/* Read a chord as name() writes it, e.g. "Ebm7/Bb". The root is put in
+   the middle octave; a bass note outside the chord is ignored. */
+bool Chord::parse(const char * text, size_t length, Chord & out) {
+	static const struct { const char * suffix; Type type; } TYPES[] = {
+		{ "7", SEV }, { "m7", MIN_SEV }, { "M7", MAJ_SEV }, { "sus4(7)", SUS4_SEV },
+	};
+	size_t i = 0;
+	int root;
+	if (!parseNote(text, length, i, root)) return false;
+	size_t end = i;
+	while (end < length && text[end] != '/') end++;
+
+	bool known = false;
+	for (const auto & t : TYPES) {
+		if (std::strlen(t.suffix) == end - i && std::memcmp(t.suffix, text + i, end - i) == 0) {
+			out.type = t.type;
+			known = true;
+		}
+	}
+	if (!known) return false;
+	out.root = Notes::MIDDLE_C + root;
+	out.inversion = 0;
+
+	if (end < length) {
+		i = end + 1;
+		int bass;
+		if (!parseNote(text, length, i, bass) || i != length) return false;
+		if (bass == Notes::chrom(out.seventh())) out.inversion = 2;
+		else if (bass == Notes::chrom(out.fifth())) out.inversion = 3;
+		else if (bass == Notes::chrom(out.third())) out.inversion = 4;
+	}
+	return true;
+}
+
 /* Compute the "average" note of all the notes in c. */
 float Chord::centerOfGravity() const {
 	const int sum = root
@@ -1,6 +1,7 @@
 #ifndef CHORD_H
 #define CHORD_H
 #include <string>
+#include <cstddef>
 
 class Chord {
 public:
@@ -20,6 +21,7 @@ public:
 	int ninth() const { return root + 14; }
 	std::string name() const;
 	float centerOfGravity() const;
+	static bool parse(const char * text, size_t length, Chord & out);
 };
 
 struct Transition {
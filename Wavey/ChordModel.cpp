@@ -0,0 +1,299 @@
+#include "ChordModel.h"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "MappedFile.h"
+
+namespace ChordModel {
+	constexpr int VERSION = 1;
+	constexpr int INTERVALS = 12;
+	// (interval, type) of the next chord
+	constexpr int OUTCOMES = INTERVALS * Chord::NUM_TYPES;
+	// current type; then previous interval, current type and previous type
+	constexpr int CONTEXTS = Chord::NUM_TYPES + OUTCOMES * Chord::NUM_TYPES;
+	// Steps a longer context needs before it is trusted over the type alone
+	constexpr uint32_t MIN_EVIDENCE = 8;
+
+	/* File layout: a header, then CONTEXTS rows, in the byte order of the
+	   machine that trained it. */
+	struct Header {
+		char magic[8];
+		uint32_t version, contexts, outcomes, reserved;
+		uint64_t songs, transitions;
+	};
+
+	// Outcome i is picked if u < threshold[i], else alias[i] is
+	struct Row {
+		uint32_t total;
+		float threshold[OUTCOMES];
+		uint8_t alias[OUTCOMES];
+	};
+
+	static_assert(sizeof(Header) == 40, "table header must have no padding");
+	static_assert(sizeof(Row) == 4 + 5 * OUTCOMES, "table rows must have no padding");
+	static_assert(OUTCOMES <= 256, "alias must fit in a byte");
+
+	const char MAGIC[8] = "WAVEYTM";
+
+	MappedFile table;
+	const Row * rows = nullptr;
+	std::string tablePath;
+
+	int interval(const Chord & from, const Chord & to) {
+		return ((to.root - from.root) % INTERVALS + INTERVALS) % INTERVALS;
+	}
+
+	int outcome(const Chord & from, const Chord & to) {
+		return interval(from, to) * Chord::NUM_TYPES + to.type;
+	}
+
+	int context(const Chord & current) {
+		return current.type;
+	}
+
+	int context(const Chord & previous, const Chord & current) {
+		return Chord::NUM_TYPES + outcome(previous, current) * Chord::NUM_TYPES + previous.type;
+	}
+
+	/* Transition counts from some of the charts. */
+	struct Counts {
+		std::vector<uint64_t> n = std::vector<uint64_t>(CONTEXTS * OUTCOMES);
+		uint64_t songs = 0, transitions = 0;
+		int files = 0, unreadable = 0;
+	};
+
+	bool isSpace(unsigned char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+	}
+
+	bool isBarLine(const unsigned char * token, size_t length) {
+		for (size_t i = 0; i < length; i++) {
+			if (token[i] != '|' && token[i] != ':') return false;
+		}
+		return true;
+	}
+
+	void count(const unsigned char * data, size_t size, Counts & counts) {
+		// The last two chords of the current chain, most recent second
+		Chord chain[2] = {};
+		int known = 0;
+		bool counted = false;
+		auto endSong = [&]() {
+			if (counted) counts.songs++;
+			counted = false;
+			known = 0;
+		};
+
+		size_t i = 0;
+		while (i < size) {
+			while (i < size && isSpace(data[i])) i++;
+			if (i == size) break;
+			if (data[i] == '\n' || data[i] == '#') {
+				endSong();
+				while (i < size && data[i] != '\n') i++;
+				i++;
+				continue;
+			}
+			while (i < size && data[i] != '\n') {
+				const size_t start = i;
+				while (i < size && data[i] != '\n' && !isSpace(data[i])) i++;
+				const size_t length = i - start;
+				while (i < size && isSpace(data[i])) i++;
+
+				if (isBarLine(data + start, length)) continue;
+				Chord c;
+				if (!Chord::parse((const char *)data + start, length, c)) {
+					known = 0;
+					continue;
+				}
+				if (known > 0 && c.root == chain[1].root && c.type == chain[1].type) continue;
+				if (known > 0) {
+					const int o = outcome(chain[1], c);
+					counts.n[context(chain[1]) * OUTCOMES + o]++;
+					if (known > 1) counts.n[context(chain[0], chain[1]) * OUTCOMES + o]++;
+					counts.transitions++;
+					counted = true;
+				}
+				chain[0] = chain[1];
+				chain[1] = c;
+				known = std::min(known + 1, 2);
+			}
+			// the newline; a chain carries on over line breaks
+			i++;
+		}
+		endSong();
+	}
+
+	/* Vose's method: split each outcome's share of the row into a part
+	   of its own slot and a part of one heavier outcome's. */
+	void buildRow(const uint64_t * n, Row & row) {
+		uint64_t total = 0;
+		for (int i = 0; i < OUTCOMES; i++) total += n[i];
+		row.total = (uint32_t)std::min<uint64_t>(total, UINT32_MAX);
+		for (int i = 0; i < OUTCOMES; i++) {
+			row.threshold[i] = 1.0f;
+			row.alias[i] = (uint8_t)i;
+		}
+		if (total == 0) return;
+
+		double scaled[OUTCOMES];
+		int small[OUTCOMES], large[OUTCOMES];
+		int numSmall = 0, numLarge = 0;
+		for (int i = 0; i < OUTCOMES; i++) {
+			scaled[i] = (double)n[i] * OUTCOMES / total;
+			if (scaled[i] < 1.0) small[numSmall++] = i;
+			else large[numLarge++] = i;
+		}
+		while (numSmall > 0 && numLarge > 0) {
+			const int s = small[--numSmall];
+			const int l = large[--numLarge];
+			row.threshold[s] = (float)scaled[s];
+			row.alias[s] = (uint8_t)l;
+			scaled[l] -= 1.0 - scaled[s];
+			if (scaled[l] < 1.0) small[numSmall++] = l;
+			else large[numLarge++] = l;
+		}
+		// Whatever is left is 1 up to rounding, and keeps its own slot
+	}
+
+	/* Charts named by the arguments, expanding '@list' files. */
+	std::vector<std::string> expand(const std::vector<std::string> & files) {
+		std::vector<std::string> charts;
+		for (const auto & f : files) {
+			if (f.size() < 2 || f[0] != '@') {
+				charts.push_back(f);
+				continue;
+			}
+			std::ifstream list(f.substr(1));
+			if (!list) {
+				std::cerr << "Could not open '" << f.substr(1) << "'." << std::endl;
+				continue;
+			}
+			std::string line;
+			while (std::getline(list, line)) {
+				if (!line.empty() && line.back() == '\r') line.pop_back();
+				if (!line.empty()) charts.push_back(line);
+			}
+		}
+		return charts;
+	}
+
+	bool train(const std::vector<std::string> & files, const std::string & path,
+		int threads, Summary & summary) {
+		const auto start = std::chrono::steady_clock::now();
+		const std::vector<std::string> charts = expand(files);
+		if (charts.empty()) {
+			std::cerr << "No charts to train on." << std::endl;
+			return false;
+		}
+		if (threads <= 0) threads = (int)std::max(1u, std::thread::hardware_concurrency());
+		threads = std::min(threads, (int)charts.size());
+
+		// Each thread takes the next chart until none are left
+		std::vector<Counts> counts(threads);
+		std::atomic<size_t> nextChart(0);
+		std::mutex errors;
+		auto work = [&](Counts & mine) {
+			for (size_t i = nextChart++; i < charts.size(); i = nextChart++) {
+				MappedFile chart;
+				if (!chart.open(charts[i])) {
+					std::lock_guard<std::mutex> guard(errors);
+					std::cerr << "Could not read '" << charts[i] << "'." << std::endl;
+					mine.unreadable++;
+					continue;
+				}
+				count(chart.data, chart.size, mine);
+				mine.files++;
+			}
+		};
+		std::vector<std::thread> workers;
+		for (int t = 1; t < threads; t++) workers.emplace_back(work, std::ref(counts[t]));
+		work(counts[0]);
+		for (auto & w : workers) w.join();
+
+		Counts & all = counts[0];
+		for (int t = 1; t < threads; t++) {
+			for (size_t i = 0; i < all.n.size(); i++) all.n[i] += counts[t].n[i];
+			all.songs += counts[t].songs;
+			all.transitions += counts[t].transitions;
+			all.files += counts[t].files;
+			all.unreadable += counts[t].unreadable;
+		}
+
+		Header header = {};
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.contexts = CONTEXTS;
+		header.outcomes = OUTCOMES;
+		header.songs = all.songs;
+		header.transitions = all.transitions;
+		std::vector<Row> table(CONTEXTS);
+		for (int c = 0; c < CONTEXTS; c++) buildRow(&all.n[c * OUTCOMES], table[c]);
+
+		std::ofstream out(path, std::ios::binary);
+		out.write((const char *)&header, sizeof(header));
+		out.write((const char *)table.data(), table.size() * sizeof(Row));
+		out.close();
+		if (!out) {
+			std::cerr << "Could not write '" << path << "'." << std::endl;
+			return false;
+		}
+
+		summary.files = all.files;
+		summary.unreadable = all.unreadable;
+		summary.songs = all.songs;
+		summary.transitions = all.transitions;
+		summary.seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		return true;
+	}
+
+	bool load(const std::string & path) {
+		rows = nullptr;
+		table.close();
+		if (!table.open(path)) {
+			std::cerr << "Could not open '" << path << "'." << std::endl;
+			return false;
+		}
+		const Header * header = (const Header *)table.data;
+		if (table.size < sizeof(Header) || std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0
+			|| header->version != VERSION || header->contexts != CONTEXTS
+			|| header->outcomes != OUTCOMES
+			|| table.size != sizeof(Header) + CONTEXTS * sizeof(Row)) {
+			std::cerr << "'" << path << "' is not a transition table." << std::endl;
+			table.close();
+			return false;
+		}
+		rows = (const Row *)(table.data + sizeof(Header));
+		tablePath = path;
+		return true;
+	}
+
+	bool loaded() {
+		return rows != nullptr;
+	}
+
+	const std::string & path() {
+		return tablePath;
+	}
+
+	bool next(const Chord * previous, const Chord & current, Transition & out) {
+		if (!rows) return false;
+		const Row * row = previous ? &rows[context(*previous, current)] : nullptr;
+		if (!row || row->total < MIN_EVIDENCE) row = &rows[context(current)];
+		if (row->total == 0) return false;
+
+		const int i = rand() % OUTCOMES;
+		const float u = (float)(rand() / (RAND_MAX + 1.0));
+		const int o = u < row->threshold[i] ? i : row->alias[i];
+		out.dist = o / Chord::NUM_TYPES;
+		out.newType = (Chord::Type)(o % Chord::NUM_TYPES);
+		return true;
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef CHORD_MODEL_H
+#define CHORD_MODEL_H
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Chord.h"
+
+/* Weighted chord transitions learned from chord charts.
+
+   A chart is plain text of chord symbols as Chord::name writes them
+   ("Dm7 G7 | CM7 Am7/G"), separated by whitespace. Bar lines are
+   skipped, a blank line or a '#' line starts a new song, and anything
+   else that isn't a chord breaks the chain. Repeated chords count once.
+
+   Each step is counted as an outcome (interval to the next root, next
+   type) in two contexts: the current type alone, and the current type
+   together with how it was reached (interval and type of the chord
+   before). Training writes each context as a row of alias tables, so a
+   table file is mapped and used as is, and picking a transition takes
+   two rand() calls whatever the corpus size. */
+namespace ChordModel {
+	struct Summary {
+		int files = 0, unreadable = 0;
+		uint64_t songs = 0, transitions = 0;
+		double seconds = 0;
+	};
+
+	/* Count the charts on up to threads threads (0 = one per core) and
+	   write the table to path. An argument '@list' names a file listing
+	   more charts, one per line. */
+	bool train(const std::vector<std::string> & files, const std::string & path,
+		int threads, Summary & summary);
+
+	bool load(const std::string & path);
+	bool loaded();
+	const std::string & path();
+
+	/* Pick a transition from current, given the chord before it if any.
+	   False when the table has nothing for this chord type. */
+	bool next(const Chord * previous, const Chord & current, Transition & out);
+}
+
+#endif // CHORD_MODEL_H
@@ -0,0 +1,259 @@
+#include "Control.h"
+#include <thread>
+#include <atomic>
+#include <iostream>
+#ifdef __linux__
+#include <map>
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "Synth.h"
+#include "Session.h"
+
+namespace Control {
+	// How long a wait lasts before checking whether to stop (ms)
+	constexpr int POLL_INTERVAL = 50;
+	constexpr int MAX_EVENTS = 64;
+	constexpr size_t READ_SIZE = 16 * 1024;
+	constexpr size_t MAX_LINE = 4096;
+	// Replies a client may leave unread before it is dropped
+	constexpr size_t MAX_PENDING = 64 * 1024;
+
+	Preparer preparer = nullptr;
+	Handler handler = nullptr;
+	std::thread server;
+	std::atomic<bool> serving = false;
+	std::string socketPath;
+
+#ifdef __linux__
+	struct Client {
+		std::string input, output;
+		bool writable = false;
+	};
+
+	int listener = -1, poller = -1;
+	std::map<int, Client> clients;
+
+	bool isSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	std::vector<std::string> tokenize(const std::string & text, size_t begin, size_t end) {
+		std::vector<std::string> tokens;
+		while (begin < end) {
+			while (begin < end && isSpace(text[begin])) begin++;
+			size_t i = begin;
+			while (i < end && !isSpace(text[i])) i++;
+			if (i > begin) tokens.emplace_back(text, begin, i - begin);
+			begin = i;
+		}
+		return tokens;
+	}
+
+	/* The commands of one line, split at ';'. */
+	std::vector<std::vector<std::string>> commands(const std::string & input, size_t begin, size_t end) {
+		std::vector<std::vector<std::string>> all;
+		while (begin < end) {
+			size_t split = input.find(';', begin);
+			if (split == std::string::npos || split > end) split = end;
+			std::vector<std::string> tokens = tokenize(input, begin, split);
+			begin = split + 1;
+			if (!tokens.empty()) all.push_back(std::move(tokens));
+		}
+		return all;
+	}
+
+	/* Run the commands of one line, recording those understood, and
+	   queue the reply. Call with the synth locked. */
+	void batch(const std::vector<std::vector<std::string>> & line, std::string & output) {
+		std::string failed;
+		for (size_t i = 0; i < line.size(); i++) {
+			if (handler(line[i])) {
+				std::string command = line[i][0];
+				for (size_t j = 1; j < line[i].size(); j++) command += ' ' + line[i][j];
+				Session::record("cmd " + command);
+			}
+			else {
+				failed += ' ' + std::to_string(i + 1);
+			}
+		}
+		output += failed.empty() ? "ok\n" : "error" + failed + "\n";
+	}
+
+	void drop(int fd) {
+		epoll_ctl(poller, EPOLL_CTL_DEL, fd, nullptr);
+		::close(fd);
+		clients.erase(fd);
+	}
+
+	/* Write what the client will take, watching for it to take more
+	   only while replies are waiting. False if it has fallen too far
+	   behind or gone. */
+	bool send(int fd, Client & client) {
+		while (!client.output.empty()) {
+			const ssize_t n = ::send(fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+			if (n > 0) {
+				client.output.erase(0, (size_t)n);
+			}
+			else if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				break;
+			}
+			else {
+				return false;
+			}
+		}
+		const bool waiting = !client.output.empty();
+		if (waiting != client.writable) {
+			epoll_event e = {};
+			e.events = waiting ? (uint32_t)(EPOLLIN | EPOLLOUT) : (uint32_t)EPOLLIN;
+			e.data.fd = fd;
+			epoll_ctl(poller, EPOLL_CTL_MOD, fd, &e);
+			client.writable = waiting;
+		}
+		return client.output.size() <= MAX_PENDING;
+	}
+
+	/* Read what has arrived and apply every whole line in it, all at
+	   the same block boundary. */
+	void receive(int fd, Client & client) {
+		char buffer[READ_SIZE];
+		ssize_t n;
+		do {
+			n = ::read(fd, buffer, sizeof(buffer));
+		} while (n < 0 && errno == EINTR);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+		const bool closed = n <= 0;
+		if (!closed) client.input.append(buffer, (size_t)n);
+
+		// Prepare every whole line first, then apply them all at once
+		std::vector<std::vector<std::vector<std::string>>> lines;
+		size_t begin = 0;
+		for (size_t end; (end = client.input.find('\n', begin)) != std::string::npos; begin = end + 1) {
+			lines.push_back(commands(client.input, begin, end));
+			for (const auto & tokens : lines.back()) preparer(tokens);
+		}
+		client.input.erase(0, begin);
+		if (!lines.empty()) {
+			Synth::lock();
+			for (const auto & line : lines) batch(line, client.output);
+			Synth::unlock();
+		}
+		if (client.input.size() > MAX_LINE) {
+			client.output += "error line too long\n";
+			send(fd, client);
+			drop(fd);
+			return;
+		}
+		if (!send(fd, client) || closed) drop(fd);
+	}
+
+	void accept() {
+		for (;;) {
+			const int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) return;
+			epoll_event e = {};
+			e.events = EPOLLIN;
+			e.data.fd = fd;
+			if (epoll_ctl(poller, EPOLL_CTL_ADD, fd, &e) != 0) {
+				::close(fd);
+				continue;
+			}
+			clients[fd] = Client();
+		}
+	}
+
+	void serve() {
+		epoll_event events[MAX_EVENTS];
+		while (serving) {
+			const int n = epoll_wait(poller, events, MAX_EVENTS, POLL_INTERVAL);
+			for (int i = 0; i < n; i++) {
+				const int fd = events[i].data.fd;
+				if (fd == listener) {
+					accept();
+					continue;
+				}
+				auto client = clients.find(fd);
+				if (client == clients.end()) continue;
+				if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+					receive(fd, client->second);
+				}
+				else if ((events[i].events & EPOLLOUT) && !send(fd, client->second)) {
+					drop(fd);
+				}
+			}
+		}
+		while (!clients.empty()) drop(clients.begin()->first);
+	}
+
+	bool listen(const std::string & path) {
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(address.sun_path)) {
+			errno = ENAMETOOLONG;
+			return false;
+		}
+		std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+		// A socket left behind by an earlier run would make bind fail
+		struct stat st;
+		if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path.c_str());
+
+		listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listener < 0 || bind(listener, (const sockaddr *)&address, sizeof(address)) != 0
+			|| ::listen(listener, SOMAXCONN) != 0) {
+			return false;
+		}
+		socketPath = path;
+		poller = epoll_create1(EPOLL_CLOEXEC);
+		if (poller < 0) return false;
+		epoll_event e = {};
+		e.events = EPOLLIN;
+		e.data.fd = listener;
+		return epoll_ctl(poller, EPOLL_CTL_ADD, listener, &e) == 0;
+	}
+#endif
+
+	bool open(const std::string & path, Preparer p, Handler h) {
+		close();
+#ifdef __linux__
+		if (!listen(path)) {
+			std::cerr << "Could not listen on '" << path << "': " << std::strerror(errno) << "." << std::endl;
+			close();
+			return false;
+		}
+		preparer = p;
+		handler = h;
+		serving = true;
+		server = std::thread(serve);
+		return true;
+#else
+		(void)path;
+		(void)p;
+		(void)h;
+		std::cerr << "The control socket is only available on Linux." << std::endl;
+		return false;
+#endif
+	}
+
+	void close() {
+		if (server.joinable()) {
+			serving = false;
+			server.join();
+		}
+#ifdef __linux__
+		if (poller >= 0) ::close(poller);
+		if (listener >= 0) ::close(listener);
+		if (!socketPath.empty()) unlink(socketPath.c_str());
+		poller = listener = -1;
+#endif
+		socketPath.clear();
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+#include <string>
+#include <vector>
+
+/* Control over a Unix-domain stream socket, for automation that sends
+   far more changes than the console can take.
+
+   Each line is a batch of console commands separated by ';':
+
+	   cutoff 900; res 0.4; harm 8
+
+   A batch is applied with the synth locked, so all of it takes effect
+   at the same block boundary, and nothing is redrawn. Every batch is
+   answered with 'ok', or 'error' and the positions (from 1) of the
+   commands that were not understood; the rest of it still applies, and
+   only what was understood is recorded. Slow parts of commands, like
+   reading a sampler map, are done before the lock is taken. Linux
+   only. */
+namespace Control {
+	// Does a command's slow part, with the synth unlocked
+	typedef void (*Preparer)(const std::vector<std::string> & tokens);
+	// Runs one command with the synth locked; false if not understood
+	typedef bool (*Handler)(const std::vector<std::string> & tokens);
+
+	bool open(const std::string & path, Preparer preparer, Handler handler);
+	void close();
+}
+
+#endif // CONTROL_H
@@ -0,0 +1,15 @@
+#include "FastMath.h"
+
+namespace FastMath {
+	float SIN_TABLE[SIN_RESOLUTION + 1];
+	float COS_TABLE[COS_RESOLUTION];
+
+	void computeTables() {
+		for (int i = 0; i <= SIN_RESOLUTION; i++) {
+			SIN_TABLE[i] = std::sin(i / ((float)SIN_RESOLUTION) * 2.0f * PI);
+		}
+		for (int i = 0; i < COS_RESOLUTION; i++) {
+			COS_TABLE[i] = std::cos(i / ((float)COS_RESOLUTION) * 2.0f * PI);
+		}
+	}
+}
@@ -0,0 +1,146 @@
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+/* Approximate math for oscillators, modulators and pitch.
+
+   FastMath::sin/cos pick an implementation at compile time through
+   WAVEY_MATH_TIER:
+	   0 - truncated lookup tables; cheapest. Max error 6.2e-3 (sin,
+	       1024 steps) and 2.5e-2 (cos, 256 steps).
+	   1 - linearly interpolated 1024-step table. Max error 4.8e-6.
+	   2 - minimax polynomial. Max error 1.4e-6, and with no table reads
+	       it vectorizes.
+   Errors are for angles (in radians) within one turn of zero; beyond
+   that, reducing the angle in float adds its own rounding.
+
+   The tier only reaches the per-block and control-rate call sites: the
+   harmonic gains, and the vibrato and duty LFOs. The oscillators, the
+   additive spectra and the filter LFO call the polynomial kernels
+   directly, whatever the tier, since they run per sample (where only the
+   polynomial vectorizes) or need its accuracy; their THD does not
+   depend on the tier. exp2 has a max relative error of 1.5e-7 and log2
+   a max absolute error of 8.9e-7. */
+#ifndef WAVEY_MATH_TIER
+#define WAVEY_MATH_TIER 0
+#endif
+
+namespace FastMath {
+	constexpr float PI = 3.14159265358979f;
+	constexpr int SIN_RESOLUTION = 1024;
+	constexpr int COS_RESOLUTION = 256;
+
+	// One guard entry so interpolation never wraps
+	extern float SIN_TABLE[SIN_RESOLUTION + 1];
+	extern float COS_TABLE[COS_RESOLUTION];
+	void computeTables();
+
+	/* Fraction of a cycle, 0.0 up to but not including 1.0, for an angle
+	   in radians. A tiny negative angle rounds up to a whole cycle,
+	   which is wrapped back to 0 so table indices stay in range. */
+	inline float cycle(float x) {
+		const float t = x / (2.0f * PI);
+		const float f = t - std::floor(t);
+		return f < 1.0f ? f : 0.0f;
+	}
+
+	inline float sinTable(float x) {
+		return SIN_TABLE[(int)(cycle(x) * SIN_RESOLUTION)];
+	}
+
+	inline float cosTable(float x) {
+		return COS_TABLE[(int)(cycle(x) * COS_RESOLUTION)];
+	}
+
+	inline float sinLerp(float x) {
+		const float t = cycle(x) * SIN_RESOLUTION;
+		const int i = (int)t;
+		const float f = t - i;
+		return SIN_TABLE[i] + f * (SIN_TABLE[i + 1] - SIN_TABLE[i]);
+	}
+
+	inline float cosLerp(float x) {
+		return sinLerp(x + 0.5f * PI);
+	}
+
+	/* sin(2 pi t) for t in -0.5-0.5 cycles. It is folded onto a quarter
+	   period, where an odd polynomial fits it, with arithmetic rather
+	   than branches or calls so loops over it vectorize. */
+	inline float sinHalf(float t) {
+		const float a = std::fabs(t);
+		const float u = std::copysign(0.25f - std::fabs(a - 0.25f), t);
+		const float u2 = u * u;
+		return u * (6.283164044f + u2 * (-41.33714237f + u2 * (81.34076889f
+			+ u2 * -70.99343328f)));
+	}
+
+	/* sin(2 pi t) for t in cycles. */
+	inline float sinCycles(float t) {
+		return sinHalf(t - std::floor(t + 0.5f));
+	}
+
+	inline float sinPoly(float x) {
+		return sinCycles(x * (1.0f / (2.0f * PI)));
+	}
+
+	inline float cosPoly(float x) {
+		return sinCycles(x * (1.0f / (2.0f * PI)) + 0.25f);
+	}
+
+	inline float sin(float x) {
+#if WAVEY_MATH_TIER >= 2
+		return sinPoly(x);
+#elif WAVEY_MATH_TIER == 1
+		return sinLerp(x);
+#else
+		return sinTable(x);
+#endif
+	}
+
+	inline float cos(float x) {
+#if WAVEY_MATH_TIER >= 2
+		return cosPoly(x);
+#elif WAVEY_MATH_TIER == 1
+		return cosLerp(x);
+#else
+		return cosTable(x);
+#endif
+	}
+
+	/* 2^x, built from a polynomial over the fraction and the exponent
+	   bits. */
+	inline float exp2(float x) {
+		x = std::fmax(-126.0f, std::fmin(127.0f, x));
+		const float i = std::floor(x);
+		const float f = x - i;
+		const float p = 0.9999999251f + f * (0.6931530732f + f * (0.2401536170f
+			+ f * (0.05582631805f + f * (0.008989340095f + f * 0.001877576673f))));
+		const int32_t bits = ((int32_t)i + 127) << 23;
+		float scale;
+		std::memcpy(&scale, &bits, sizeof(scale));
+		return p * scale;
+	}
+
+	/* log2(x) for x > 0, from the exponent bits and a polynomial over
+	   the mantissa. */
+	inline float log2(float x) {
+		int32_t bits;
+		std::memcpy(&bits, &x, sizeof(bits));
+		const float e = (float)(((bits >> 23) & 0xFF) - 127);
+		bits = (bits & 0x007FFFFF) | 0x3F800000;
+		float m;
+		std::memcpy(&m, &bits, sizeof(m));
+		m -= 1.0f;
+		return e + m * (1.442667829f + m * (-0.7205854689f + m * (0.4735534114f
+			+ m * (-0.3259019739f + m * (0.1942943224f + m * (-0.07955773081f
+			+ m * 0.01552991725f))))));
+	}
+
+	inline float pow(float base, float exponent) {
+		return exp2(exponent * log2(base));
+	}
+}
+
+#endif // FAST_MATH_H
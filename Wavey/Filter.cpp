@@ -0,0 +1,147 @@
+#include "Filter.h"
+#include <cmath>
+#include <algorithm>
+#include "Synth.h"
+#include "FastMath.h"
+
+namespace Filter {
+	constexpr int CHUNK = 64;
+
+	// Per-lane integrator states (trapezoidal, zero-delay feedback)
+	alignas(32) float svf1[LANES], svf2[LANES];
+	alignas(32) float ladder[4][LANES];
+
+	// Coefficients reached at the end of the last block
+	float lastG = -1.0f, lastRes = 0.0f;
+	float lfoPhase = 0.0f;
+	// Filter the states belong to
+	int lastType = OFF;
+
+	/* Clear the integrator states. Left over from the other filter, or
+	   from long ago, they would kick its feedback loop out of range. */
+	void reset() {
+		std::fill(svf1, svf1 + LANES, 0.0f);
+		std::fill(svf2, svf2 + LANES, 0.0f);
+		for (auto & stage : ladder) std::fill(stage, stage + LANES, 0.0f);
+		lastG = -1.0f;
+	}
+
+	/* Cheap tanh for the ladder's input stage. */
+	inline float saturate(float x) {
+		x = std::max(-3.0f, std::min(3.0f, x));
+		return x * (27.0f + x * x) / (27.0f + 9.0f * x * x);
+	}
+
+	/* Cutoff for this block, with modulation, as the prewarped integrator
+	   gain g = tan(pi fc / fs). */
+	float targetGain(const Settings & s, int length) {
+		const float lfo = s.lfoDepth * FastMath::sinCycles(lfoPhase);
+		lfoPhase += s.lfoRate * length / Synth::SAMPLE_RATE;
+		lfoPhase -= std::floor(lfoPhase);
+		float fc = s.cutoff * FastMath::exp2(s.envAmount * s.envelope + lfo);
+		fc = std::max(20.0f, std::min(fc, 0.45f * Synth::SAMPLE_RATE));
+		return std::tan(FastMath::PI * fc / Synth::SAMPLE_RATE);
+	}
+
+	/* TPT state-variable low-pass over interleaved lanes. */
+	void svf(float * x, int n, float g, float dg, float res, float dres) {
+		for (int i = 0; i < n; i++, g += dg, res += dres) {
+			const float k = 2.0f - 1.98f * res;
+			const float a1 = 1.0f / (1.0f + g * (g + k));
+			const float a2 = g * a1, a3 = g * a2;
+			float * v = x + i * LANES;
+			for (int j = 0; j < LANES; j++) {
+				const float v3 = v[j] - svf2[j];
+				const float v1 = a1 * svf1[j] + a2 * v3;
+				const float v2 = svf2[j] + a2 * svf1[j] + a3 * v3;
+				svf1[j] = 2.0f * v1 - svf1[j];
+				svf2[j] = 2.0f * v2 - svf2[j];
+				v[j] = v2;
+			}
+		}
+	}
+
+	/* 4-pole TPT ladder. The feedback loop is solved linearly, then the
+	   input is saturated, so loud voices drive it independently. */
+	void moog(float * x, int n, float g, float dg, float res, float dres) {
+		for (int i = 0; i < n; i++, g += dg, res += dres) {
+			const float G = g / (1.0f + g), b = 1.0f / (1.0f + g);
+			const float G2 = G * G, G4 = G2 * G2;
+			const float k = 3.9f * res;
+			const float norm = 1.0f / (1.0f + k * G4);
+			float * v = x + i * LANES;
+			for (int j = 0; j < LANES; j++) {
+				const float S = b * (G2 * G * ladder[0][j] + G2 * ladder[1][j]
+					+ G * ladder[2][j] + ladder[3][j]);
+				const float y4 = (G4 * v[j] + S) * norm;
+				float u = saturate(v[j] - k * y4);
+				for (int p = 0; p < 4; p++) {
+					const float w = (u - ladder[p][j]) * G;
+					const float y = w + ladder[p][j];
+					ladder[p][j] = y + w;
+					u = y;
+				}
+				v[j] = u * (1.0f + k);
+			}
+		}
+	}
+
+	/* Filter each voice and write their sum into out. Coefficients move
+	   linearly from last block's values to this block's across the block. */
+	void process(const Settings & settings, float * const voices[], int count,
+		float * out, int length) {
+		if (settings.type != lastType) {
+			reset();
+			lastType = settings.type;
+		}
+		const float g = targetGain(settings, length);
+		const float res = std::max(0.0f, std::min(settings.resonance, 1.0f));
+		if (lastG < 0.0f) {
+			lastG = g;
+			lastRes = res;
+		}
+		const float dg = (g - lastG) / length, dres = (res - lastRes) / length;
+		count = std::min(count, LANES);
+
+		alignas(32) float lanes[CHUNK * LANES];
+		for (int start = 0; start < length; start += CHUNK) {
+			const int n = std::min(CHUNK, length - start);
+			std::fill(lanes, lanes + n * LANES, 0.0f);
+			for (int j = 0; j < count; j++) {
+				for (int i = 0; i < n; i++) {
+					lanes[i * LANES + j] = voices[j][start + i];
+				}
+			}
+
+			const float g0 = lastG + dg * start, r0 = lastRes + dres * start;
+			if (settings.type == LADDER) {
+				moog(lanes, n, g0, dg, r0, dres);
+			}
+			else {
+				svf(lanes, n, g0, dg, r0, dres);
+			}
+
+			for (int i = 0; i < n; i++) {
+				float mix = 0.0f;
+				for (int j = 0; j < count; j++) {
+					mix += lanes[i * LANES + j];
+				}
+				out[start + i] = mix;
+			}
+		}
+		lastG = g;
+		lastRes = res;
+	}
+
+	void bypass() {
+		lastType = OFF;
+	}
+
+	const char * name(int type) {
+		switch (type) {
+		case SVF: return "svf";
+		case LADDER: return "ladder";
+		}
+		return "off";
+	}
+}
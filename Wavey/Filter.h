@@ -0,0 +1,37 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+/* Resonant low-pass filters run on every voice separately, between the
+   oscillators and the volume envelope. Voices share coefficients and are
+   processed side by side in lanes, so one SIMD register filters several
+   voices at once. */
+namespace Filter {
+	enum Type { OFF, SVF, LADDER, NUM_TYPES };
+	constexpr int LANES = 8;
+	// Ranges the controls accept: cutoff (Hz), modulation depth either
+	// way (octaves) and LFO rate (Hz)
+	constexpr float MIN_CUTOFF = 20.0f, MAX_CUTOFF = 20000.0f;
+	constexpr float MAX_OCTAVES = 8.0f;
+	constexpr float MAX_LFO_RATE = 100.0f;
+
+	struct Settings {
+		int type = OFF;
+		// cutoff in Hz, resonance 0.0-1.0
+		float cutoff = 2000.0f;
+		float resonance = 0.0f;
+		// cutoff modulation in octaves: by the envelope, and an LFO
+		float envAmount = 0.0f;
+		float lfoDepth = 0.0f;
+		float lfoRate = 0.0f;
+		// current envelope level, 0.0-1.0
+		float envelope = 0.0f;
+	};
+
+	void process(const Settings & settings, float * const voices[], int count,
+		float * out, int length);
+	// Call for blocks rendered unfiltered, so filtering starts afresh
+	void bypass();
+	const char * name(int type);
+}
+
+#endif // FILTER_H
@@ -0,0 +1,21 @@
+#include "Fixed.h"
+#include <cmath>
+#include "Synth.h"
+
+namespace Fixed {
+	int16_t SIN_TABLE[1 << SIN_BITS];
+
+	void computeTables() {
+		const int size = 1 << SIN_BITS;
+		for (int i = 0; i < size; i++) {
+			const double x = std::sin(i * 2.0 * 3.14159265358979323846 / size);
+			SIN_TABLE[i] = saturate((int32_t)std::lround(x * ONE));
+		}
+	}
+
+	uint32_t phaseInc(float freq) {
+		double cycles = (double)freq / Synth::SAMPLE_RATE;
+		cycles -= std::floor(cycles);
+		return (uint32_t)(cycles * 4294967296.0);
+	}
+}
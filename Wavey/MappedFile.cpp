@@ -0,0 +1,56 @@
+#include "MappedFile.h"
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string & path) {
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER length;
+	if (!GetFileSizeEx(file, &length) || length.QuadPart == 0) return false;
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) return false;
+	data = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	size = (size_t)length.QuadPart;
+	return data != nullptr;
+}
+
+void MappedFile::close() {
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	data = nullptr;
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+}
+#else
+bool MappedFile::open(const std::string & path) {
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) return false;
+	void * p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) return false;
+	// Under mlockall the pages read would stay resident; let them go
+	munlock(p, st.st_size);
+	data = (const unsigned char *)p;
+	size = (size_t)st.st_size;
+	return true;
+}
+
+void MappedFile::close() {
+	if (data) munmap((void *)data, size);
+	if (fd >= 0) ::close(fd);
+	data = nullptr;
+	size = 0;
+	fd = -1;
+}
+#endif
@@ -0,0 +1,23 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#include <string>
+#include <cstddef>
+
+/* Read-only view of a whole file. */
+class MappedFile {
+public:
+	~MappedFile() { close(); }
+	bool open(const std::string & path);
+	void close();
+	const unsigned char * data = nullptr;
+	size_t size = 0;
+private:
+#ifdef _WIN32
+	// HANDLEs, kept opaque so windows.h stays out of the header
+	void * file = (void *)-1, * mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,262 @@
+#include "Midi.h"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <poll.h>
+#endif
+#include "Synth.h"
+#include "Notes.h"
+#include "Ring.h"
+#include "Session.h"
+
+namespace Midi {
+	constexpr int MIDDLE_C = 60;
+	constexpr int QUEUE_SIZE = 1024;
+	// How long a read waits before checking whether to stop (ms)
+	constexpr int POLL_INTERVAL = 50;
+
+	bool Parser::feed(uint8_t byte, Message & out) {
+		// Real-time bytes can turn up anywhere, even mid-message
+		if (byte >= 0xF8) return false;
+		if (byte >= 0x80) {
+			// System messages cancel running status; their data bytes
+			// (and all of system exclusive) are then dropped below
+			status = byte < 0xF0 ? byte : 0;
+			needed = (byte & 0xE0) == 0xC0 ? 1 : 2;
+			count = 0;
+			return false;
+		}
+		if (status == 0) return false;
+		data[count++] = byte;
+		if (count < needed) return false;
+		count = 0;
+		out.status = status;
+		out.data1 = data[0];
+		out.data2 = needed == 2 ? data[1] : 0;
+		return true;
+	}
+
+	int fd = -1;
+	bool ownFd = false;
+	std::thread reader;
+	std::atomic<bool> reading = false;
+	Ring<Event> queue(QUEUE_SIZE);
+
+	// Note held by each voice (-1 = free), and when it last changed
+	int voiceNotes[Synth::NUM_CHANNELS];
+	unsigned voiceAges[Synth::NUM_CHANNELS];
+	unsigned age = 0;
+	bool owning = false;
+
+	int64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void read() {
+		Parser parser;
+		uint8_t buffer[256];
+		while (reading) {
+#ifdef _WIN32
+			const int n = _read(fd, buffer, sizeof(buffer));
+#else
+			pollfd p = { fd, POLLIN, 0 };
+			if (poll(&p, 1, POLL_INTERVAL) <= 0) continue;
+			const int n = (int)::read(fd, buffer, sizeof(buffer));
+#endif
+			if (n <= 0) break;
+			const int64_t arrival = now();
+			Message m;
+			for (int i = 0; i < n; i++) {
+				if (parser.feed(buffer[i], m)) {
+					const Event e = { m, arrival };
+					queue.write(&e, 1);
+				}
+			}
+		}
+		reading = false;
+	}
+
+	bool open(const std::string & path) {
+		close();
+		if (path == "-") {
+			fd = 0;
+			ownFd = false;
+#ifdef _WIN32
+			_setmode(fd, _O_BINARY);
+#endif
+		}
+		else {
+#ifdef _WIN32
+			fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+			// Don't wait here for a FIFO's writer; reads block again after
+			fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK);
+			if (fd >= 0) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+#endif
+			ownFd = true;
+		}
+		if (fd < 0) {
+			std::cerr << "Could not open '" << path << "'." << std::endl;
+			return false;
+		}
+
+		Synth::lock();
+		reset();
+		Synth::unlock();
+
+		reading = true;
+		reader = std::thread(read);
+		return true;
+	}
+
+	void close() {
+		if (reader.joinable()) {
+			reading = false;
+#ifdef _WIN32
+			// A console or pipe read can't be interrupted
+			reader.detach();
+#else
+			reader.join();
+#endif
+		}
+		if (ownFd && fd >= 0) {
+#ifdef _WIN32
+			_close(fd);
+#else
+			::close(fd);
+#endif
+		}
+		fd = -1;
+	}
+
+	bool running() {
+		return reading;
+	}
+
+	void reset() {
+		Session::record("midi reset");
+		owning = true;
+		for (int j = 0; j < Synth::NUM_CHANNELS; j++) {
+			voiceNotes[j] = -1;
+			voiceAges[j] = 0;
+			Synth::channels[j].on = false;
+		}
+	}
+
+	bool ownsVoices() {
+		return owning;
+	}
+
+	int receive(Event * events, int max) {
+		return queue.read(events, max);
+	}
+
+	/* The voice for a new note: the one already on it, else a silent
+	   one, else the one released longest ago, else the one held longest. */
+	int pickVoice(int note) {
+		for (int j = 0; j < Synth::NUM_CHANNELS; j++) {
+			if (voiceNotes[j] == note) return j;
+		}
+		for (int j = 0; j < Synth::NUM_CHANNELS; j++) {
+			if (voiceNotes[j] < 0 && !Synth::channels[j].on) return j;
+		}
+		int voice = -1;
+		for (int j = 0; j < Synth::NUM_CHANNELS; j++) {
+			if (voiceNotes[j] < 0 && (voice < 0 || voiceAges[j] < voiceAges[voice])) voice = j;
+		}
+		if (voice >= 0) return voice;
+		voice = 0;
+		for (int j = 1; j < Synth::NUM_CHANNELS; j++) {
+			if (voiceAges[j] < voiceAges[voice]) voice = j;
+		}
+		return voice;
+	}
+
+	void noteOn(int note) {
+		const int key = note - MIDDLE_C + Notes::MIDDLE_C;
+		if (key < 0 || key >= 88) return;
+		bool held = false;
+		for (int j = 0; j < Synth::NUM_CHANNELS; j++) {
+			held |= voiceNotes[j] >= 0 && voiceNotes[j] != note;
+		}
+		const bool restart = !held || Synth::config.volume <= 0.0f;
+		// A new phrase: released notes still ringing end with the envelope
+		if (restart) {
+			for (int j = 0; j < Synth::NUM_CHANNELS; j++) {
+				if (voiceNotes[j] < 0) Synth::channels[j].on = false;
+			}
+		}
+
+		const int voice = pickVoice(note);
+		voiceNotes[voice] = note;
+		voiceAges[voice] = ++age;
+		// Voices sound an octave below their channel frequency
+		Synth::channels[voice].freq = 2.0f * Notes::freqs[key];
+		Synth::channels[voice].on = true;
+		if (restart) {
+			Synth::resetNote();
+			Synth::attackRelease();
+		}
+		else {
+			Synth::startVoice(voice);
+		}
+	}
+
+	/* The voice rings on, so there's no click; it's reused first. */
+	void noteOff(int note) {
+		for (int j = 0; j < Synth::NUM_CHANNELS; j++) {
+			if (voiceNotes[j] == note) {
+				voiceNotes[j] = -1;
+				voiceAges[j] = ++age;
+			}
+		}
+	}
+
+	void apply(const Message & message) {
+		const int type = message.status & 0xF0;
+		if (type != 0x80 && type != 0x90) return;
+		// This runs on the audio thread, so the line is built on the stack
+		if (Session::recording()) {
+			char line[FORMAT_SIZE];
+			format(message, line);
+			Session::recordFromAudio(line);
+		}
+		if (type == 0x90 && message.data2 > 0) {
+			noteOn(message.data1);
+		}
+		else {
+			noteOff(message.data1);
+		}
+	}
+
+	void format(const Message & message, char text[FORMAT_SIZE]) {
+		std::snprintf(text, FORMAT_SIZE, "midi %02x %02x %02x",
+			message.status, message.data1, message.data2);
+	}
+
+	std::string format(const Message & message) {
+		char text[FORMAT_SIZE];
+		format(message, text);
+		return text;
+	}
+
+	bool parse(const std::string & text, Message & message) {
+		std::istringstream in(text);
+		std::string word;
+		int status, data1, data2;
+		if (!(in >> word >> std::hex >> status >> data1 >> data2) || word != "midi") return false;
+		message.status = (uint8_t)status;
+		message.data1 = (uint8_t)data1;
+		message.data2 = (uint8_t)data2;
+		return true;
+	}
+}
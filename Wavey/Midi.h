@@ -0,0 +1,66 @@
+#ifndef MIDI_H
+#define MIDI_H
+#include <cstdint>
+#include <string>
+
+/* MIDI input from a raw byte stream: a FIFO, a file, or '-' for stdin.
+   Note on/off messages (any channel) play the synth's voices, pitched
+   from Notes::freqs; everything else is parsed and ignored. Once MIDI
+   has the voices the chord progression stops assigning them.
+
+   The voices share the synth's one attack-release envelope, as on a
+   paraphonic synth. It restarts for a note played with no other held
+   (or once it has died away); notes added to a held chord join it where
+   it is, so held notes never drop out. A released note isn't cut, which
+   would click: it rings on with the envelope until its voice is needed
+   or the envelope restarts.
+
+   A reader thread stamps each message with its arrival time. The render
+   thread takes them at the start of every block and plays each one
+   exactly a block after it arrived, at the matching sample inside the
+   block, so timing between notes is kept and note-on to sound is never
+   more than one block. */
+namespace Midi {
+	struct Message {
+		uint8_t status = 0, data1 = 0, data2 = 0;
+	};
+
+	struct Event {
+		Message message;
+		// steady clock nanoseconds
+		int64_t arrival = 0;
+	};
+
+	/* Turns a byte stream into channel messages, handling running
+	   status, and skipping system exclusive and real-time bytes. */
+	class Parser {
+	public:
+		// True once a whole message has been read into out
+		bool feed(uint8_t byte, Message & out);
+	private:
+		uint8_t status = 0;
+		uint8_t data[2] = {};
+		int count = 0, needed = 0;
+	};
+
+	bool open(const std::string & path);
+	void close();
+	// The stream is still being read
+	bool running();
+
+	// Free every voice and take them over from the progression
+	void reset();
+	bool ownsVoices();
+	// Render thread: messages that arrived since the last call
+	int receive(Event * events, int max);
+	// Play a message on the voices; call with the synth locked
+	void apply(const Message & message);
+	// 'midi <status> <data1> <data2>' in hex, as recorded in sessions
+	constexpr int FORMAT_SIZE = 16;
+	std::string format(const Message & message);
+	// The same into a buffer, without allocating
+	void format(const Message & message, char text[FORMAT_SIZE]);
+	bool parse(const std::string & text, Message & message);
+}
+
+#endif // MIDI_H
@@ -1,5 +1,6 @@
 #include "Notes.h"
 #include <math.h>
+#include "FastMath.h"
 
 namespace Notes {
 
@@ -10,10 +11,17 @@ namespace Notes {
 	float freqs[88];
 	void computeFreqs() {
 		for (int i = 0; i < 88; i++) {
-			freqs[i] = (float)(pow(1.05946309436, i - 49.0) * 440.0);
+			freqs[i] = FastMath::exp2((i - 49) / 12.0f) * 440.0f;
 		}
 	}
 
+	/* Return the note closest in pitch to the given frequency. */
+	int nearest(float freq) {
+		if (freq <= 0.0f) return 0;
+		const int note = (int)floor(12.0f * FastMath::log2(freq / 440.0f) + 49.5f);
+		return note < 0 ? 0 : (note > 87 ? 87 : note);
+	}
+
 	/* Shift the given note to within the octave from middle C. */
 	int middleOctave(int note) {
 		return MIDDLE_C + (note + 8) % 12;
@@ -6,6 +6,7 @@ namespace Notes {
 	constexpr int MIDDLE_C = 40;
 	extern float freqs[88];
 	void computeFreqs();
+	int nearest(float freq);
 	int middleOctave(int note);
 	int chrom(int note);
 	const std::string & name(int note);
@@ -0,0 +1,255 @@
+#include "Realtime.h"
+#include <mutex>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <pmmintrin.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace Realtime {
+	// SCHED_FIFO for audio, SCHED_RR below it for control
+	constexpr int AUDIO_PRIORITY = 80;
+	constexpr int CONTROL_PRIORITY = 60;
+	// Stack the audio thread may grow into, faulted in on entry
+	constexpr size_t STACK_PREFAULT = 256 * 1024;
+	constexpr size_t PAGE = 4096;
+
+	struct Region {
+		void * data;
+		size_t size;
+		const char * name;
+	};
+
+	Profile profile;
+	std::mutex mutex;
+	std::vector<std::string> problems;
+	std::vector<Region> regions;
+	// memory has been locked, and whether that covers new allocations
+	bool locked = false, lockedFuture = false;
+
+	void fail(const std::string & what) {
+		std::lock_guard<std::mutex> guard(mutex);
+		if (std::find(problems.begin(), problems.end(), what) == problems.end()) {
+			problems.push_back(what);
+		}
+	}
+
+	void configure(const Profile & p) {
+		profile = p;
+#ifndef __linux__
+		if (profile.enabled) {
+			fail("realtime scheduling and memory locking are only available on Linux");
+		}
+#endif
+	}
+
+	bool enabled() {
+		return profile.enabled;
+	}
+
+	std::vector<std::string> failures() {
+		std::lock_guard<std::mutex> guard(mutex);
+		return problems;
+	}
+
+#ifdef __linux__
+	std::string reason(int error) {
+		if (error == EPERM) return "not permitted";
+		if (error == ENOMEM || error == EAGAIN) return "over the memlock limit";
+		return std::strerror(error);
+	}
+
+	void lockRegion(const Region & r) {
+		if (mlock(r.data, r.size) != 0) {
+			fail(std::string("could not lock ") + r.name + ": " + reason(errno));
+		}
+	}
+#endif
+
+	void prefault(void * data, size_t size, const char * name) {
+		if (!profile.enabled || size == 0) return;
+		// Write every page so none is left mapped to the shared zero page
+		volatile char * p = (volatile char *)data;
+		for (size_t i = 0; i < size; i += PAGE) p[i] = p[i];
+		p[size - 1] = p[size - 1];
+
+		const Region r = { data, size, name };
+		bool lockNow;
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			regions.push_back(r);
+			lockNow = locked && !lockedFuture;
+		}
+#ifdef __linux__
+		if (lockNow) lockRegion(r);
+#else
+		(void)lockNow;
+#endif
+	}
+
+	void release(void * data, size_t size) {
+		if (!profile.enabled || size == 0) return;
+		bool wasLocked;
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			auto r = std::find_if(regions.begin(), regions.end(),
+				[data](const Region & r) { return r.data == data; });
+			if (r == regions.end()) return;
+			regions.erase(r);
+			wasLocked = locked;
+		}
+#ifdef __linux__
+		// Only pages wholly inside the buffer; the edges may be shared
+		// with memory that is still in use
+		const uintptr_t first = ((uintptr_t)data + PAGE - 1) & ~(uintptr_t)(PAGE - 1);
+		const uintptr_t last = ((uintptr_t)data + size) & ~(uintptr_t)(PAGE - 1);
+		if (wasLocked && last > first) munlock((void *)first, last - first);
+#else
+		(void)wasLocked;
+#endif
+	}
+
+	/* Lock everything mapped now if the limits allow. New allocations are
+	   locked too when the memlock limit is unlimited, but only as their
+	   pages are touched: MCL_FUTURE alone would read every file mapped
+	   later (sampler WAVs included) into memory whole. Failing that, lock
+	   just the prefaulted buffers. */
+	void lockMemory() {
+		if (!profile.enabled) return;
+#ifdef __linux__
+		struct rlimit limit;
+		const bool unlimited = getrlimit(RLIMIT_MEMLOCK, &limit) == 0
+			&& limit.rlim_cur == RLIM_INFINITY;
+		if (mlockall(MCL_CURRENT) == 0) {
+#ifdef MCL_ONFAULT
+			const bool future = unlimited && mlockall(MCL_FUTURE | MCL_ONFAULT) == 0;
+#else
+			const bool future = false;
+#endif
+			if (!unlimited) {
+				fail("memory allocated later is only locked where prefaulted (memlock limit "
+					+ std::to_string(limit.rlim_cur / 1024) + " KB)");
+			}
+			else if (!future) {
+				fail("memory allocated later is only locked where prefaulted "
+					"(no lock-on-fault in this kernel)");
+			}
+			std::lock_guard<std::mutex> guard(mutex);
+			locked = true;
+			lockedFuture = future;
+			return;
+		}
+		fail("could not lock all memory: " + reason(errno) + "; locking the synth's buffers only");
+		std::vector<Region> pending;
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			pending = regions;
+			locked = true;
+		}
+		for (const Region & r : pending) lockRegion(r);
+#endif
+	}
+
+#ifdef __linux__
+	/* Give the calling thread the policy at priority, or as close as the
+	   rtprio limit allows, and pin it to cpu. */
+	void schedule(const char * name, int policy, int priority, int cpu) {
+		struct rlimit limit;
+		if (geteuid() != 0 && getrlimit(RLIMIT_RTPRIO, &limit) == 0
+			&& limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur > 0) {
+			priority = std::min(priority, (int)limit.rlim_cur);
+		}
+		sched_param param = {};
+		param.sched_priority = std::min(priority, sched_get_priority_max(policy));
+		int error = pthread_setschedparam(pthread_self(), policy, &param);
+		if (error != 0) {
+			fail(std::string(name) + " thread: no "
+				+ (policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR") + " priority "
+				+ std::to_string(param.sched_priority) + ": " + reason(error)
+				+ (error == EPERM ? " (needs CAP_SYS_NICE or an rtprio limit)" : ""));
+		}
+		if (cpu >= 0) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+			if (error != 0) {
+				fail(std::string(name) + " thread: could not pin to CPU "
+					+ std::to_string(cpu) + ": " + reason(error));
+			}
+		}
+	}
+#endif
+
+	void enterAudioThread() {
+		if (!profile.enabled) return;
+#ifdef __linux__
+		schedule("audio", SCHED_FIFO, AUDIO_PRIORITY, profile.audioCpu);
+#endif
+		// Denormals in decaying reverb and filter state cost far more
+		// than they are worth
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+		_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+		_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
+#elif defined(__aarch64__)
+		uint64_t fpcr;
+		asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+		asm volatile("msr fpcr, %0" : : "r"(fpcr | (1ull << 24)));
+#else
+		fail("audio thread: no flush-to-zero on this CPU");
+#endif
+		char stack[STACK_PREFAULT];
+		volatile char * top = stack;
+		for (size_t i = 0; i < STACK_PREFAULT; i += PAGE) top[i] = 0;
+	}
+
+	void enterControlThread() {
+		if (!profile.enabled) return;
+#ifdef __linux__
+		schedule("control", SCHED_RR, CONTROL_PRIORITY, profile.controlCpu);
+#endif
+	}
+
+#ifdef __linux__
+	Mutex::Mutex() {
+		pthread_mutexattr_t attributes;
+		pthread_mutexattr_init(&attributes);
+		pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutexattr_setprotocol(&attributes, PTHREAD_PRIO_INHERIT);
+		pthread_mutex_init(&mutex, &attributes);
+		pthread_mutexattr_destroy(&attributes);
+	}
+
+	Mutex::~Mutex() {
+		pthread_mutex_destroy(&mutex);
+	}
+
+	void Mutex::lock() {
+		pthread_mutex_lock(&mutex);
+	}
+
+	void Mutex::unlock() {
+		pthread_mutex_unlock(&mutex);
+	}
+#else
+	Mutex::Mutex() {}
+	Mutex::~Mutex() {}
+
+	void Mutex::lock() {
+		mutex.lock();
+	}
+
+	void Mutex::unlock() {
+		mutex.unlock();
+	}
+#endif
+}
@@ -0,0 +1,68 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+#include <cstddef>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#else
+#include <mutex>
+#endif
+
+/* Opt-in realtime profile. When enabled, the audio thread (the render
+   thread, or the device callback when there is none) and the control
+   thread get realtime scheduling and optionally a CPU each, the audio
+   thread flushes denormals to zero, and memory is locked with the
+   synth's buffers faulted in ahead of time.
+
+   Scheduling and memory locking are only available on Linux, and need
+   CAP_SYS_NICE / CAP_IPC_LOCK or matching rtprio and memlock limits.
+   Nothing here is fatal: whatever can't be had is recorded, and the
+   synth carries on without it. */
+namespace Realtime {
+	struct Profile {
+		bool enabled = false;
+		// CPU to pin each thread to (-1 = any)
+		int audioCpu = -1, controlCpu = -1;
+	};
+
+	void configure(const Profile & profile);
+	bool enabled();
+
+	/* Touch every page of a buffer the audio thread will use. Buffers
+	   given before lockMemory are locked with everything else; later
+	   ones are locked on their own if future allocations aren't. */
+	void prefault(void * data, size_t size, const char * name);
+	// Forget a prefaulted buffer before it is freed, unlocking it
+	void release(void * data, size_t size);
+	void lockMemory();
+
+	// Call from the thread itself, once
+	void enterAudioThread();
+	void enterControlThread();
+
+	// What the profile could not obtain
+	std::vector<std::string> failures();
+
+	/* Recursive mutex for what the audio thread shares with the rest.
+	   On Linux it inherits priority: whoever holds it runs at the
+	   priority of the audio thread waiting on it, so it can't be held up
+	   by everything scheduled in between. */
+	class Mutex {
+	public:
+		Mutex();
+		~Mutex();
+		Mutex(const Mutex &) = delete;
+		Mutex & operator=(const Mutex &) = delete;
+		void lock();
+		void unlock();
+	private:
+#ifdef __linux__
+		pthread_mutex_t mutex;
+#else
+		std::recursive_mutex mutex;
+#endif
+	};
+}
+
+#endif // REALTIME_H
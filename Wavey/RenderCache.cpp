@@ -0,0 +1,101 @@
+#include "RenderCache.h"
+#include <vector>
+#include <algorithm>
+#include "Synth.h"
+#include "Realtime.h"
+
+namespace RenderCache {
+	constexpr int POOL_SECONDS = 30;
+	constexpr int MAX_ENTRIES = 32;
+
+	struct Entry {
+		uint64_t key;
+		// pool offset, note position of the first sample, and samples
+		int start, first, length;
+		float progress[Synth::NUM_CHANNELS];
+	};
+
+	std::vector<float> pool;
+	int used = 0;
+	Entry entries[MAX_ENTRIES];
+	int count = 0;
+	int current = -1;
+
+	/* FNV-1a over the given bytes. */
+	uint64_t hash(uint64_t seed, const void * data, size_t size) {
+		const unsigned char * p = (const unsigned char *)data;
+		for (size_t i = 0; i < size; i++) {
+			seed = (seed ^ p[i]) * 1099511628211ull;
+		}
+		return seed;
+	}
+
+	void init() {
+		pool.assign(POOL_SECONDS * Synth::SAMPLE_RATE, 0.0f);
+		clear();
+	}
+
+	void prefault() {
+		Realtime::prefault(pool.data(), pool.size() * sizeof(float), "render cache");
+	}
+
+	void clear() {
+		used = 0;
+		count = 0;
+		current = -1;
+	}
+
+	/* Select the entry for a new note. On a hit, progress is replaced with
+	   the recorded starting progress; on a miss, it is saved with a fresh
+	   entry that the note's audio will be recorded into. */
+	bool begin(uint64_t key, float progress[]) {
+		for (int i = 0; i < count; i++) {
+			if (entries[i].key == key) {
+				current = i;
+				std::copy(entries[i].progress, entries[i].progress + Synth::NUM_CHANNELS, progress);
+				return true;
+			}
+		}
+		if (count == MAX_ENTRIES) clear();
+		current = count++;
+		Entry & e = entries[current];
+		e.key = key;
+		e.start = used;
+		e.first = 0;
+		e.length = 0;
+		std::copy(progress, progress + Synth::NUM_CHANNELS, e.progress);
+		return false;
+	}
+
+	void end() {
+		current = -1;
+	}
+
+	/* Copy recorded audio starting position samples into the note. */
+	bool read(float * out, int position, int length) {
+		if (current < 0) return false;
+		const Entry & e = entries[current];
+		if (position < e.first || position + length > e.first + e.length) return false;
+		const int from = e.start + position - e.first;
+		std::copy(&pool[from], &pool[from + length], out);
+		return true;
+	}
+
+	/* Extend the current entry, starting it at the first position
+	   written. Only the newest entry can grow, and only without gaps;
+	   anything else is left unrecorded. */
+	void write(const float * in, int position, int length) {
+		if (current < 0) return;
+		Entry & e = entries[current];
+		if (e.start + e.length != used) return;
+		if (e.length == 0) e.first = position;
+		if (position != e.first + e.length) return;
+		if (used + length > (int)pool.size()) {
+			clear();
+			return;
+		}
+		std::copy(in, in + length, &pool[used]);
+		e.length += length;
+		used += length;
+	}
+}
@@ -0,0 +1,27 @@
+#ifndef RENDER_CACHE_H
+#define RENDER_CACHE_H
+#include <cstdint>
+#include <cstddef>
+
+/* Dry audio of previously played notes, replayed when the same chord
+   comes around again with the same patch. Each entry records the voice
+   progress at the start of its note so the live renderer can pick up
+   exactly where the recording ends. Recording starts at the first
+   block actually rendered, since a note's first block is often still
+   silent; earlier blocks are rendered live on replay. All storage comes from one pool
+   allocated up front; when it fills, the cache starts over. */
+namespace RenderCache {
+	constexpr uint64_t SEED = 14695981039346656037ull;
+	uint64_t hash(uint64_t seed, const void * data, size_t size);
+
+	void init();
+	void prefault();
+	void clear();
+
+	bool begin(uint64_t key, float progress[]);
+	void end();
+	bool read(float * out, int position, int length);
+	void write(const float * in, int position, int length);
+}
+
+#endif // RENDER_CACHE_H
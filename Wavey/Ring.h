@@ -0,0 +1,73 @@
+#ifndef RING_H
+#define RING_H
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+/* Lock-free ring buffer for exactly one writer thread and one reader
+   thread. Capacity is rounded up to a power of two; the head and tail
+   run freely and are masked on access, so a full ring holds all of it. */
+template <typename T>
+class Ring {
+public:
+	explicit Ring(int capacity = 0) {
+		resize(capacity);
+	}
+
+	// Empty the ring and make room for capacity items; only safe while
+	// neither side is running
+	void resize(int capacity) {
+		int size = 1;
+		while (size < capacity) size <<= 1;
+		buffer.assign(size, T());
+		mask = (uint32_t)size - 1;
+		head = 0;
+		tail = 0;
+	}
+
+	T * data() {
+		return buffer.data();
+	}
+
+	int capacity() const {
+		return (int)buffer.size();
+	}
+
+	// Items ready to be read
+	int size() const {
+		return (int)(head.load(std::memory_order_acquire)
+			- tail.load(std::memory_order_relaxed));
+	}
+
+	// Copy in up to length items, returning how many fit
+	int write(const T * data, int length) {
+		const uint32_t h = head.load(std::memory_order_relaxed);
+		const uint32_t t = tail.load(std::memory_order_acquire);
+		const int n = std::min(length, capacity() - (int)(h - t));
+		const int first = std::min(n, capacity() - (int)(h & mask));
+		std::copy(data, data + first, buffer.begin() + (h & mask));
+		std::copy(data + first, data + n, buffer.begin());
+		head.store(h + n, std::memory_order_release);
+		return n;
+	}
+
+	// Copy out up to length items, returning how many there were
+	int read(T * data, int length) {
+		const uint32_t t = tail.load(std::memory_order_relaxed);
+		const uint32_t h = head.load(std::memory_order_acquire);
+		const int n = std::min(length, (int)(h - t));
+		const int first = std::min(n, capacity() - (int)(t & mask));
+		std::copy(buffer.begin() + (t & mask), buffer.begin() + (t & mask) + first, data);
+		std::copy(buffer.begin(), buffer.begin() + (n - first), data + first);
+		tail.store(t + n, std::memory_order_release);
+		return n;
+	}
+
+private:
+	std::vector<T> buffer;
+	uint32_t mask = 0;
+	std::atomic<uint32_t> head{0}, tail{0};
+};
+
+#endif // RING_H
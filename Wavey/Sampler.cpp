@@ -0,0 +1,395 @@
+#include "Sampler.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <SDL.h>
+#include "Notes.h"
+#include "Synth.h"
+#include "Realtime.h"
+#include "MappedFile.h"
+
+namespace Sampler {
+	// Frames at the start of each zone kept in RAM
+	constexpr int PRELOAD_FRAMES = 16384;
+	// Frames streamed ahead of each voice
+	constexpr int RING_FRAMES = 65536;
+	constexpr int CHUNK_FRAMES = 4096;
+	constexpr unsigned IDLE_ZONE = 0xFFFF;
+
+	uint32_t u16(const unsigned char * p) { return p[0] | (p[1] << 8); }
+	uint32_t u32(const unsigned char * p) { return u16(p) | (u16(p + 2) << 16); }
+
+	/* One multisample and the keys it covers. */
+	struct Zone {
+		int low, high, root;
+		MappedFile file;
+		const unsigned char * samples = nullptr;
+		int64_t frames = 0;
+		int channels = 0, bytes = 0, sampleRate = 0;
+		bool isFloat = false;
+		std::vector<float> attack;
+
+		~Zone() {
+			Realtime::release(attack.data(), attack.size() * sizeof(float));
+		}
+
+		/* Decode frame n straight from the mapped file, mixed to mono. */
+		float read(int64_t n) const {
+			const unsigned char * p = samples + n * channels * bytes;
+			float sum = 0.0f;
+			for (int c = 0; c < channels; c++, p += bytes) {
+				if (isFloat) {
+					float f;
+					std::memcpy(&f, p, 4);
+					sum += f;
+				}
+				else if (bytes == 2) {
+					sum += (int16_t)u16(p) / 32768.0f;
+				}
+				else if (bytes == 3) {
+					sum += (int32_t)((p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24))
+						/ 2147483648.0f;
+				}
+				else {
+					sum += (int32_t)u32(p) / 2147483648.0f;
+				}
+			}
+			return sum / channels;
+		}
+	};
+
+	/* Locate the format and sample data of a mapped RIFF/WAVE file. */
+	bool parseWav(Zone & z) {
+		const unsigned char * p = z.file.data;
+		const unsigned char * end = p + z.file.size;
+		if (z.file.size < 12 || std::memcmp(p, "RIFF", 4) || std::memcmp(p + 8, "WAVE", 4))
+			return false;
+		p += 12;
+		int format = 0, bits = 0;
+		while (p + 8 <= end) {
+			const uint32_t size = u32(p + 4);
+			const unsigned char * body = p + 8;
+			if (!std::memcmp(p, "fmt ", 4) && size >= 16 && body + 16 <= end) {
+				format = u16(body);
+				z.channels = u16(body + 2);
+				z.sampleRate = u32(body + 4);
+				bits = u16(body + 14);
+				// WAVE_FORMAT_EXTENSIBLE keeps the real format in its GUID
+				if (format == 0xFFFE && size >= 26 && body + 26 <= end)
+					format = u16(body + 24);
+			}
+			else if (!std::memcmp(p, "data", 4)) {
+				z.samples = body;
+				z.frames = std::min<int64_t>(size, end - body);
+			}
+			p = body + size + (size & 1);
+		}
+		z.bytes = bits / 8;
+		z.isFloat = format == 3 && bits == 32;
+		const bool pcm = format == 1 && (bits == 16 || bits == 24 || bits == 32);
+		if (!z.samples || z.channels == 0 || z.sampleRate == 0 || !(pcm || z.isFloat))
+			return false;
+		z.frames /= z.channels * z.bytes;
+		return true;
+	}
+
+	struct Instrument {
+		std::vector<std::unique_ptr<Zone>> zones;
+
+		/* Zone covering key, otherwise the one nearest to it. */
+		int zoneFor(int key) const {
+			int best = 0, bestDist = 1 << 30;
+			for (int i = 0; i < (int)zones.size(); i++) {
+				const Zone & z = *zones[i];
+				const int dist = key < z.low ? z.low - key :
+					(key > z.high ? key - z.high : 0);
+				if (dist < bestDist) {
+					best = i;
+					bestDist = dist;
+				}
+			}
+			return best;
+		}
+	};
+
+	/* Shared between the audio and prefetch threads. The voice publishes
+	   which zone it plays and the oldest frame it still needs; the
+	   prefetcher publishes how far the ring has been filled. Both carry
+	   the voice's trigger generation so stale data is never read. */
+	struct Stream {
+		std::atomic<uint64_t> request;
+		std::atomic<uint64_t> filled;
+		float ring[RING_FRAMES];
+	};
+
+	/* Audio thread only. */
+	struct Voice {
+		int zone = -1;
+		unsigned gen = 0;
+		double position = 0.0;
+	};
+
+	/* Swapped with the synth locked, which is how the audio thread reads
+	   it. The prefetcher takes its own reference, so an instrument it is
+	   still reading from lives until it's done. */
+	std::shared_ptr<Instrument> instrument;
+	// Whether there is one, for readers that don't hold the lock
+	std::atomic<bool> present{false};
+	// What prepare() read, and the map it came from
+	std::shared_ptr<Instrument> pending;
+	std::string pendingPath;
+	std::mutex pendingMutex;
+	Stream streams[Synth::NUM_CHANNELS];
+	Voice voices[Synth::NUM_CHANNELS];
+	std::thread prefetcher;
+	std::atomic<bool> prefetching = false;
+	std::atomic<unsigned> underrunCount = 0;
+	bool waitForStream = false;
+
+	uint64_t pack(unsigned gen, unsigned zone, int64_t frame) {
+		return ((uint64_t)(gen & 0xFFFF) << 48) | ((uint64_t)(zone & 0xFFFF) << 32)
+			| (uint32_t)frame;
+	}
+
+	/* Keep every voice's ring filled ahead of its play position. All
+	   reads of the mapped files (and so all page faults) happen here. */
+	void prefetch() {
+		unsigned gens[Synth::NUM_CHANNELS];
+		int64_t writes[Synth::NUM_CHANNELS];
+		std::fill(gens, gens + Synth::NUM_CHANNELS, ~0u);
+
+		while (prefetching) {
+			for (int c = 0; c < Synth::NUM_CHANNELS; c++) {
+				Stream & s = streams[c];
+				const uint64_t request = s.request.load(std::memory_order_acquire);
+				const unsigned gen = (unsigned)(request >> 48);
+				const unsigned zone = (unsigned)(request >> 32) & 0xFFFF;
+				const int64_t read = (uint32_t)request;
+				if (zone == IDLE_ZONE) continue;
+				// Taken after the request, so at least as new as its zone
+				const std::shared_ptr<Instrument> current = std::atomic_load(&instrument);
+				if (!current || zone >= current->zones.size()) continue;
+
+				const Zone & z = *current->zones[zone];
+				if (gen != gens[c]) {
+					gens[c] = gen;
+					writes[c] = std::max<int64_t>(z.attack.size(), read);
+				}
+				const int64_t end = std::min(z.frames, read + RING_FRAMES);
+				while (writes[c] < end) {
+					const int64_t n = std::min<int64_t>(CHUNK_FRAMES, end - writes[c]);
+					for (int64_t i = writes[c]; i < writes[c] + n; i++) {
+						s.ring[i % RING_FRAMES] = z.read(i);
+					}
+					writes[c] += n;
+					s.filled.store(pack(gen, 0, writes[c]), std::memory_order_release);
+				}
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+	}
+
+	void stopPrefetch() {
+		if (prefetcher.joinable()) {
+			prefetching = false;
+			prefetcher.join();
+		}
+	}
+
+	void startPrefetch() {
+		prefetching = true;
+		prefetcher = std::thread(prefetch);
+	}
+
+	/* Swap in a new instrument (or none) with every voice silenced. The
+	   old one is let go of once the synth is unlocked. */
+	void replace(std::shared_ptr<Instrument> next) {
+		Synth::lock();
+		const std::shared_ptr<Instrument> old = std::atomic_exchange(&instrument, next);
+		present = next != nullptr;
+		for (int c = 0; c < Synth::NUM_CHANNELS; c++) {
+			voices[c].zone = -1;
+			streams[c].request = pack(voices[c].gen, IDLE_ZONE, 0);
+		}
+		if (next && !prefetcher.joinable()) startPrefetch();
+		Synth::unlock();
+	}
+
+	/* Read a mapping file and its zones; null if any of it is unusable. */
+	std::shared_ptr<Instrument> read(const std::string & mapPath) {
+		std::ifstream in(mapPath);
+		if (!in) {
+			std::cerr << "Could not open '" << mapPath << "'." << std::endl;
+			return nullptr;
+		}
+		const size_t slash = mapPath.find_last_of("/\\");
+		const std::string dir = slash == std::string::npos ? "" : mapPath.substr(0, slash + 1);
+
+		auto next = std::make_shared<Instrument>();
+		std::string line;
+		while (std::getline(in, line)) {
+			if (line.empty() || line[0] == '#') continue;
+			std::istringstream iss(line);
+			std::string path;
+			auto zone = std::make_unique<Zone>();
+			if (!(iss >> path >> zone->low >> zone->high >> zone->root)
+				|| zone->low < 0 || zone->high > 87 || zone->low > zone->high
+				|| zone->root < 0 || zone->root > 87) {
+				std::cerr << "Invalid zone '" << line << "'." << std::endl;
+				return nullptr;
+			}
+			if (!zone->file.open(dir + path) || !parseWav(*zone)) {
+				std::cerr << "Could not load '" << dir + path << "'." << std::endl;
+				return nullptr;
+			}
+			zone->attack.resize((size_t)std::min<int64_t>(zone->frames, PRELOAD_FRAMES));
+			for (size_t i = 0; i < zone->attack.size(); i++) {
+				zone->attack[i] = zone->read(i);
+			}
+			Realtime::prefault(zone->attack.data(), 
+				zone->attack.size() * sizeof(float), "sampler attack");
+			next->zones.push_back(std::move(zone));
+		}
+		if (next->zones.empty() || next->zones.size() >= IDLE_ZONE) {
+			std::cerr << "No zones in '" << mapPath << "'." << std::endl;
+			return nullptr;
+		}
+		return next;
+	}
+
+	/* Read a mapping file and its zones ahead of load(). */
+	bool prepare(const std::string & mapPath) {
+		std::shared_ptr<Instrument> next = read(mapPath);
+		std::lock_guard<std::mutex> guard(pendingMutex);
+		pending = next;
+		pendingPath = mapPath;
+		return next != nullptr;
+	}
+
+	bool load(const std::string & mapPath) {
+		std::shared_ptr<Instrument> next;
+		bool prepared = false;
+		{
+			std::lock_guard<std::mutex> guard(pendingMutex);
+			if (pendingPath == mapPath) {
+				next.swap(pending);
+				pendingPath.clear();
+				prepared = true;
+			}
+		}
+		if (!prepared) next = read(mapPath);
+		if (!next) return false;
+		replace(next);
+		return true;
+	}
+
+	void unload() {
+		replace(nullptr);
+	}
+
+	bool loaded() {
+		return present;
+	}
+
+	void destroy() {
+		stopPrefetch();
+		present = false;
+		std::atomic_store(&instrument, std::shared_ptr<Instrument>());
+		std::lock_guard<std::mutex> guard(pendingMutex);
+		pending = nullptr;
+		pendingPath.clear();
+	}
+
+	/* The streaming rings are touched a voice at a time; fault them all
+	   in before anything plays. */
+	void prefault() {
+		Realtime::prefault(streams, sizeof(streams), "sampler streams");
+	}
+
+	/* Restart the channel's voice on the zone nearest to freq (Hz). */
+	void trigger(int channel, float freq) {
+		if (!instrument) return;
+		Voice & v = voices[channel];
+		v.zone = instrument->zoneFor(Notes::nearest(freq));
+		v.gen = (v.gen + 1) & 0xFFFF;
+		v.position = 0.0;
+		streams[channel].request.store(pack(v.gen, v.zone, 0), std::memory_order_release);
+	}
+
+	/* 4-point Hermite interpolation between y1 and y2. */
+	float hermite(float y0, float y1, float y2, float y3, float t) {
+		const float c1 = 0.5f * (y2 - y0);
+		const float c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+		const float c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+		return ((c3 * t + c2) * t + c1) * t + y1;
+	}
+
+	/* Add the channel's voice, resampled to play at freq (Hz), into out. */
+	void render(int channel, float * out, int length, float freq) {
+		if (!instrument) return;
+		Voice & v = voices[channel];
+		if (v.zone < 0) return;
+
+		const Zone & z = *instrument->zones[v.zone];
+		Stream & s = streams[channel];
+		const double rate = (double)freq / Notes::freqs[z.root]
+			* z.sampleRate / Synth::SAMPLE_RATE;
+		const int64_t preloaded = z.attack.size();
+		auto streamed = [&]() {
+			const uint64_t filled = s.filled.load(std::memory_order_acquire);
+			return (filled >> 48) == v.gen ? (int64_t)(uint32_t)filled : (int64_t)0;
+		};
+		int64_t written = streamed();
+		if (waitForStream) {
+			const int64_t last = std::min<int64_t>(z.frames,
+				(int64_t)(v.position + rate * length) + 3);
+			while (last > preloaded && written < last) {
+				std::this_thread::yield();
+				written = streamed();
+			}
+		}
+		bool starved = false;
+		auto frame = [&](int64_t n) {
+			if (n < 0 || n >= z.frames) return 0.0f;
+			if (n < preloaded) return z.attack[(size_t)n];
+			if (n < written && n + RING_FRAMES >= written) return s.ring[n % RING_FRAMES];
+			starved = true;
+			return 0.0f;
+		};
+
+		for (int i = 0; i < length; i++) {
+			const int64_t n = (int64_t)v.position;
+			const float t = (float)(v.position - n);
+			out[i] += hermite(frame(n - 1), frame(n), frame(n + 1), frame(n + 2), t);
+			v.position += rate;
+		}
+		if (starved) underrunCount++;
+
+		if (v.position >= z.frames) {
+			v.zone = -1;
+			s.request.store(pack(v.gen, IDLE_ZONE, 0), std::memory_order_release);
+		}
+		else {
+			const int64_t oldest = std::max<int64_t>(0, (int64_t)v.position - 1);
+			s.request.store(pack(v.gen, v.zone, oldest), std::memory_order_release);
+		}
+	}
+
+	/* Blocks where a voice outran the prefetcher. */
+	unsigned underruns() {
+		return underrunCount;
+	}
+
+	void setBlocking(bool blocking) {
+		waitForStream = blocking;
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+#include <string>
+
+/* Multisampled instrument playback. An instrument is described by a
+   mapping file with one zone per line:
+
+	   <wav file> <low key> <high key> <root key>
+
+   where keys index Notes::freqs and the wav path is relative to the
+   mapping file. Lines starting with '#' are ignored.
+
+   WAV files are memory-mapped rather than read in. The start of every
+   zone is copied to RAM up front, and the remainder is streamed into
+   each voice by a prefetch thread, so the audio callback never waits
+   on the disk.
+
+   Nothing is read from disk with the synth locked. prepare() reads a
+   mapping and its files; load() then swaps them in, briefly locking,
+   and only reads them itself if that map wasn't just prepared. */
+namespace Sampler {
+	bool prepare(const std::string & mapPath);
+	bool load(const std::string & mapPath);
+	void unload();
+	bool loaded();
+	void prefault();
+	// Stop streaming for good; not with the synth locked
+	void destroy();
+
+	void trigger(int channel, float freq);
+	void render(int channel, float * out, int length, float freq);
+	unsigned underruns();
+	// Offline rendering waits on the prefetcher rather than dropping out
+	void setBlocking(bool blocking);
+}
+
+#endif // SAMPLER_H
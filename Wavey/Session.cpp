@@ -0,0 +1,162 @@
+#include "Session.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <mutex>
+#include <cstring>
+#include <type_traits>
+#include "Synth.h"
+#include "Ring.h"
+
+namespace Session {
+	constexpr int VERSION = 1;
+
+	std::ofstream file;
+	std::atomic<bool> active = false;
+	// lines recorded but not yet written
+	std::string pending;
+	std::mutex mutex;
+	// held while writing, so flushes from two threads keep their order
+	std::mutex fileMutex;
+
+	// Lines from the audio thread, waiting to join pending
+	constexpr int AUDIO_LINES = 1024;
+	constexpr int AUDIO_LINE_SIZE = 24;
+	struct AudioLine {
+		uint64_t clock;
+		char text[AUDIO_LINE_SIZE];
+	};
+	Ring<AudioLine> audioLines(AUDIO_LINES);
+	std::atomic<unsigned> lostLines{0};
+
+	const char * format() {
+		return std::is_same<Synth::Sample, float>::value ? "float" : "int16";
+	}
+
+	bool start(const std::string & path, unsigned seed, int frames) {
+		file.open(path);
+		if (!file) {
+			std::cerr << "Could not open '" << path << "'." << std::endl;
+			return false;
+		}
+		file << "wavey-session " << VERSION << "\n"
+			<< "seed " << seed << "\n"
+			<< "frames " << frames << "\n"
+			<< "format " << format() << "\n";
+		file.flush();
+		active = true;
+		return true;
+	}
+
+	bool recording() {
+		return active;
+	}
+
+	/* Move the audio thread's lines into pending; call holding mutex.
+	   They were stamped no later than anything being recorded now. */
+	void takeAudioLines() {
+		AudioLine line;
+		while (audioLines.read(&line, 1) == 1) {
+			pending += std::to_string(line.clock);
+			pending += ' ';
+			pending += line.text;
+			pending += '\n';
+		}
+	}
+
+	void recordFromAudio(const char * what) {
+		if (!active) return;
+		AudioLine line;
+		line.clock = Synth::clock();
+		std::strncpy(line.text, what, AUDIO_LINE_SIZE - 1);
+		line.text[AUDIO_LINE_SIZE - 1] = '\0';
+		if (audioLines.write(&line, 1) == 0) lostLines++;
+	}
+
+	void record(const std::string & what) {
+		if (!active) return;
+		std::lock_guard<std::mutex> guard(mutex);
+		takeAudioLines();
+		pending += std::to_string(Synth::clock());
+		pending += ' ';
+		pending += what;
+		pending += '\n';
+	}
+
+	void flush() {
+		if (!active) return;
+		std::lock_guard<std::mutex> writing(fileMutex);
+		std::string lines;
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			takeAudioLines();
+			lines.swap(pending);
+		}
+		file << lines;
+		file.flush();
+	}
+
+	void stop() {
+		if (!active) return;
+		Synth::lock();
+		std::ostringstream end;
+		end << "end " << std::hex << Synth::stats().hash;
+		record(end.str());
+		Synth::unlock();
+		flush();
+		std::lock_guard<std::mutex> writing(fileMutex);
+		active = false;
+		file.close();
+		if (lostLines > 0) {
+			std::cerr << lostLines << " events from the audio thread could not be recorded;"
+				" the session won't replay exactly." << std::endl;
+		}
+	}
+
+	bool load(const std::string & path, Recording & recording) {
+		std::ifstream in(path);
+		if (!in) {
+			std::cerr << "Could not open '" << path << "'." << std::endl;
+			return false;
+		}
+		std::string magic, key;
+		int version = 0;
+		if (!(in >> magic >> version) || magic != "wavey-session" || version != VERSION
+			|| !(in >> key >> recording.seed) || key != "seed"
+			|| !(in >> key >> recording.frames) || key != "frames" || recording.frames <= 0
+			|| !(in >> key >> recording.format) || key != "format") {
+			std::cerr << "'" << path << "' is not a session file." << std::endl;
+			return false;
+		}
+
+		std::string line;
+		while (std::getline(in, line)) {
+			if (line.empty()) continue;
+			std::istringstream iss(line);
+			Event e;
+			std::string what;
+			if (!(iss >> e.clock >> what)) {
+				std::cerr << "Invalid event '" << line << "'." << std::endl;
+				return false;
+			}
+			if (what == "end") {
+				recording.end = e.clock;
+				iss >> std::hex >> recording.hash;
+				break;
+			}
+			std::string rest;
+			std::getline(iss, rest);
+			e.what = rest.empty() ? what : what + rest;
+			if (!recording.events.empty() && e.clock < recording.events.back().clock) {
+				std::cerr << "Event out of order '" << line << "'." << std::endl;
+				return false;
+			}
+			recording.events.push_back(e);
+		}
+		if (recording.events.empty() && recording.end == 0) {
+			std::cerr << "No events in '" << path << "'." << std::endl;
+			return false;
+		}
+		return true;
+	}
+}
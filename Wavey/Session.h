@@ -0,0 +1,57 @@
+#ifndef SESSION_H
+#define SESSION_H
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Session recording. A session file is a header followed by everything
+   that changed the synth, one line each, stamped with the sample clock
+   of the block boundary where it took effect:
+
+	   wavey-session 1
+	   seed <rand seed>
+	   frames <block size>
+	   format float|int16
+	   <clock> tick
+	   <clock> cmd <command line>
+	   <clock> model <transition table>
+	   ...
+	   <clock> end <output hash>
+
+   'tick' is one update of the control thread, and 'model' the chord
+   table it picks from, which must still be there to replay. Replaying
+   the events at the same clocks with the same seed and block size
+   reproduces the audio bit for bit, which the end hash confirms. */
+namespace Session {
+	struct Event {
+		uint64_t clock;
+		std::string what;
+	};
+
+	struct Recording {
+		unsigned seed = 0;
+		int frames = 0;
+		std::string format;
+		uint64_t end = 0, hash = 0;
+		std::vector<Event> events;
+	};
+
+	// Sample format of this build, as named in the header
+	const char * format();
+
+	bool start(const std::string & path, unsigned seed, int frames);
+	bool recording();
+	// Call with the synth locked, so the clock is at a block boundary
+	void record(const std::string & what);
+	/* From the audio thread: stamp a short line with the clock now and
+	   queue it without locking or allocating. It is written out ahead of
+	   anything recorded after it. */
+	void recordFromAudio(const char * what);
+	// Write out what has been recorded; not with the synth locked
+	void flush();
+	void stop();
+
+	bool load(const std::string & path, Recording & recording);
+}
+
+#endif // SESSION_H
@@ -1,154 +1,678 @@
 #include "Synth.h"
 #include <iostream>
 #include <algorithm>
+#include <vector>
+#include <array>
+#include <utility>
+#include <type_traits>
+#include <thread>
+#include <mutex>
+#include <chrono>
 #include <SDL.h>
+#include "Additive.h"
+#include "Sampler.h"
+#include "Fixed.h"
+#include "RenderCache.h"
+#include "FastMath.h"
+#include "Filter.h"
+#include "Ring.h"
+#include "Realtime.h"
+#include "Midi.h"
 
-constexpr int SIN_RESOLUTION = 1024;
-float SIN_TABLE[SIN_RESOLUTION];
-float COS_TABLE[256];
-void computeSinCos() {
-	for (int i = 0; i < SIN_RESOLUTION; i++) {
-		SIN_TABLE[i] = std::sinf(i / ((float)SIN_RESOLUTION) * 2.0f * (float)M_PI);
-	}
-	for (int i = 0; i < 256; i++) {
-		COS_TABLE[i] = std::cosf(i / 256.0f * 2.0f * (float)M_PI);
+/* Waveforms over t, the fraction of the cycle (0.0-1.0). They select
+   rather than branch, so the oscillator loops vectorize. */
+namespace Waveform {
+	/* t - floor(t), without the call to floor. */
+	inline float fraction(float t) {
+		const float f = t - (float)(int)t;
+		return f + (f < 0.0f ? 1.0f : 0.0f);
 	}
-}
-float sinLookup(float x) {
-	double dummy;
-	x = (float)std::modf(x / (2.0f * (float)M_PI), &dummy);
-	return SIN_TABLE[(int)(x * SIN_RESOLUTION)];
-}
-float cosLookup(float x) {
-	double dummy;
-	x = (float)std::modf(x / (2.0f * (float)M_PI), &dummy);
-	return COS_TABLE[(int) (x * 256)];
-}
 
-namespace Waveform {
-	float sin(float x) {
-		return sinLookup(x);
+	inline float sin(float t) {
+		return FastMath::sinHalf(t - (float)(int)(t + 0.5f));
 	}
 
-	float square(float x, float duty) {
-		double dummy;
-		x = (float)std::modf(x / (2.0f * (float)M_PI), &dummy);
-		return x < duty ? 1.0f : -1.0f;
+	inline float square(float t, float duty) {
+		return t < duty ? 1.0f : -1.0f;
 	}
 
-	float sawtooth(float x) {
-		double dummy;
-		x = (float)std::modf(x / (2.0f * (float)M_PI), &dummy);
-		return 2 * x - 1;
+	inline float sawtooth(float t) {
+		return 2 * t - 1;
 	}
 
-	float triangle(float x) {
-		double dummy;
-		x = (float)std::modf(x / (2.0f * (float)M_PI), &dummy);
-		if (x < 0.5f) {
-			return 4.0f * x - 1.0f;
-		}
-		else {
-			return -4.0f * x + 3.0f;
-		}
+	inline float triangle(float t) {
+		return 1.0f - 4.0f * std::fabs(t - 0.5f);
 	}
 }
 
 namespace Synth {
 	constexpr int SAMPLES = 1024; 
+	// Smallest device buffer, and how many device buffers the render
+	// thread may queue ahead at most
+	constexpr int MIN_SAMPLES = 64;
+	constexpr int MAX_AHEAD = 32;
+	// Render ahead with no misses this long (s) before queueing less
+	constexpr float CALM_TIME = 2.0f;
 	constexpr float REVERB_DIST = 0.2f;
 	constexpr int REVERB_SAMPLES = (int) (SAMPLE_RATE * REVERB_DIST);
-	float reverb[REVERB_SAMPLES];
+	template <typename T> T reverb[REVERB_SAMPLES];
 	int reverbFrame = 0;
+	// level below which a voice or tail counts as silent (-100 dB)
+	constexpr float SILENCE = 1e-5f;
+	int quietSamples = 0;
+	bool reverbIdle = true;
 	Channel channels[NUM_CHANNELS];
 	Config config;
 	SDL_AudioDeviceID device;
+	Additive::Spectrum spectrum;
+	std::vector<float> voiceMix;
+	// one buffer per voice while the filter is on
+	std::vector<float> voiceLanes;
+	unsigned lastNote = 0;
+	// samples since the last attack
+	int notePosition = 0;
+	uint64_t noteKey = 0, cachedPatch = 0;
+
+	// Render-ahead output
+	int frames = SAMPLES;
+	bool renderAhead = false;
+	Ring<Sample> ring;
+	std::thread renderer;
+	std::atomic<bool> rendering{false};
+	// Guards everything rendering reads. Recursive so a whole command
+	// can hold it around its own locking; the device callback takes it too.
+	Realtime::Mutex renderMutex;
+	std::atomic<int> watermark{0};
+	std::atomic<unsigned> underruns{0}, nearMisses{0};
+	// the device callback has set up its thread
+	bool callbackEntered = false;
+	bool headless = false;
+	// frames produced, and block render timing in nanoseconds
+	std::atomic<uint64_t> frameClock{0};
+	std::atomic<uint64_t> blocks{0}, renderTotal{0}, renderMax{0};
+	std::atomic<uint64_t> cachedBlocks{0};
+	std::atomic<uint64_t> outputHash{RenderCache::SEED};
 
-	float wave(float x, unsigned char params) {
+	// MIDI messages waiting for their frame, in clock order
+	constexpr int MAX_SCHEDULED = 256;
+	struct Scheduled {
+		uint64_t clock;
+		Midi::Message message;
+	};
+	Scheduled scheduled[MAX_SCHEDULED];
+	int scheduledCount = 0;
+	// once notes are played, the envelope follows every (part) block
+	bool noteEnvelope = false;
+
+	/* Oscillator mix for a fixed set of waveforms at t through the
+	   cycle. The tests on Waves are resolved at compile time. */
+	template <unsigned char Waves>
+	float wave(float t, float duty) {
 		float mix = 0.0f;
+		if (Waves & SINE) {
+			mix += Waveform::sin(t);
+		}
+		if (Waves & SQUARE) {
+			mix += Waveform::square(t, duty) * 0.25f;
+		}
+		if (Waves & SAWTOOTH) {
+			mix += Waveform::sawtooth(t) * 0.3f;
+		}
+		if (Waves & TRIANGLE) {
+			mix += Waveform::triangle(t) * 0.6f;
+		}
+		return mix;
+	}
+
+	/* Add every active channel with Depth harmonics of the Waves mix
+	   into its buffer in outs. */
+	template <unsigned char Waves, int Depth>
+	void oscillate(float * const outs[NUM_CHANNELS], int length, 
+		const float offset[NUM_CHANNELS], const float harms[8]) {
+		const float duty = config.duty;
+		for (int j = 0; j < NUM_CHANNELS; j++) {
+			if (!channels[j].active) continue;
+			// cycles per sample
+			const float step = (channels[j].freq / 2.0f + config.shift) / SAMPLE_RATE;
+			float * out = outs[j];
+			// One pass per harmonic keeps the loop over samples flat
+			float vol = 1.0f;
+			for (int k = 0; k < Depth; k++) {
+				const float gain = harms[k] * vol;
+				const float harmonicStep = (k + 1) * step;
+				const float start = offset[j];
+				for (int i = 0; i < length; i++) {
+					const float t = Waveform::fraction(harmonicStep * (start + i));
+					out[i] += gain * wave<Waves>(t, duty);
+				}
+				vol *= 0.75f;
+			}
+		}
+	}
+
+	/* One kernel per waveform mask and harmonic count (1-8), indexed
+	   by waveforms * 8 + harmonics - 1. */
+	typedef void (*Kernel)(float * const *, int, const float *, const float *);
+	template <int... I>
+	constexpr std::array<Kernel, sizeof...(I)> makeKernels(std::integer_sequence<int, I...>) {
+		return { { &oscillate<(unsigned char)(I / 8), I % 8 + 1>... } };
+	}
+	constexpr auto KERNELS = makeKernels(std::make_integer_sequence<int, 16 * 8>());
+
+	int32_t wave(uint32_t phase, unsigned char params, uint32_t duty) {
+		int32_t mix = 0;
 		if (params & 0b0001) {
-			mix += Waveform::sin(x);
-		} 
+			mix += Fixed::sin(phase);
+		}
 		if (params & 0b0010) {
-			mix += Waveform::square(x, config.duty) * 0.25f;
+			mix += Fixed::square(phase, duty) / 4;
 		}
 		if (params & 0b0100) {
-			mix += Waveform::sawtooth(x) * 0.3f;
+			mix += Fixed::sawtooth(phase) * 9830 / Fixed::ONE;
 		}
 		if (params & 0b1000) {
-			mix += Waveform::triangle(x) * 0.6f;
+			mix += Fixed::triangle(phase) * 19661 / Fixed::ONE;
 		}
 		return mix;
 	}
 
-	float waveHarmonics(float x, unsigned char params, int depth, float harms[8]) {
-		float mix = 0.0f;
-		float vol = 1.0f;
+	/* Harmonic gains are Q14 so each product fits in 32 bits. */
+	int32_t waveHarmonics(uint32_t phase, unsigned char params, int depth, 
+		const int32_t gains[8], uint32_t duty) {
+		int32_t mix = 0;
 		for (int i = 0; i < depth; i++) {
-			mix += harms[i] * wave((i + 1) * x, params) * vol;
-			vol *= 0.75f;
+			mix += gains[i] * wave((i + 1) * phase, params, duty) >> 14;
 		}
 		return mix;
 	}
 
-	void genSamples(float * stream, int length) {
+	/* Record from 0.0-1.0 the location across the current waveform
+	   after length samples. */
+	void advanceProgress(const float offset[NUM_CHANNELS], int length) {
 		const float mul = (float)(2.0f * M_PI) / SAMPLE_RATE;
+		for (int j = 0; j < NUM_CHANNELS; j++) {
+			const float x = (channels[j].freq / 2.0f + config.shift)
+				* (offset[j] + length) * mul;
+			double dummy;
+			channels[j].progress = (float)std::modf(x / (2.0f * (float)M_PI), &dummy);
+		}
+	}
+
+	/* Mix the voices, apply the volume and reverb and write the output.
+	   One overload per device format. */
+	void mixBlock(float * stream, int length, const float *, const float * voices) {
+		float * line = reverb<float>;
+		for (int i = 0; i < length; i ++) {
+			float mix = voices ? voices[i] : 0.0f;
+			mix *= config.volume;
+			mix += line[reverbFrame] * 0.5f;
+			stream[i] = mix;
+			line[reverbFrame] = mix;
+			reverbFrame = (reverbFrame + 1) % REVERB_SAMPLES;
+			quietSamples = std::fabs(mix) < SILENCE ? quietSamples + 1 : 0;
+		}
+	}
+
+	void mixBlock(int16_t * stream, int length, const float *, const float * voices) {
+		// Gains and phase steps are worked out once per block
+		int32_t gains[8];
+		float vol = 1.0f;
+		for (int i = 0; i < config.harmonics; i++) {
+			gains[i] = (int32_t)(FastMath::cos(i * config.harmonicOffset + i) * vol * 16384.0f);
+			vol *= 0.75f;
+		}
+		uint32_t phase[NUM_CHANNELS], inc[NUM_CHANNELS];
+		for (int j = 0; j < NUM_CHANNELS; j++) {
+			inc[j] = Fixed::phaseInc(channels[j].freq / 2.0f + config.shift);
+			phase[j] = (uint32_t)(int64_t)(channels[j].progress * 4294967296.0);
+		}
+		const double dutyCycle = std::max(0.0, std::min((double)config.duty, 1.0));
+		const uint32_t duty = (uint32_t)std::min(dutyCycle * 4294967296.0, 4294967295.0);
+		const int32_t volume = Fixed::fromFloat(config.volume);
+
+		int16_t * line = reverb<int16_t>;
+		for (int i = 0; i < length; i++) {
+			int32_t mix = 0;
+			if (voices) {
+				mix = Fixed::fromFloat(voices[i]);
+			}
+			else {
+				for (int j = 0; j < NUM_CHANNELS; j++) {
+					if (channels[j].active) {
+						mix += waveHarmonics(phase[j], config.waveforms, 
+							config.harmonics, gains, duty);
+					}
+					phase[j] += inc[j];
+				}
+			}
+			mix = (int32_t)((int64_t)mix * volume / Fixed::ONE);
+			const int16_t out = Fixed::saturate(mix + line[reverbFrame] / 2);
+			stream[i] = out;
+			line[reverbFrame] = out;
+			reverbFrame = (reverbFrame + 1) % REVERB_SAMPLES;
+			quietSamples = out == 0 ? quietSamples + 1 : 0;
+		}
+	}
+
+	/* Hash of every parameter the dry voices depend on, or 0 when some
+	   modulator makes them drift over time so they can't be replayed.
+	   The envelope and reverb are applied live and don't count. */
+	uint64_t patchKey() {
+		// The filter's state carries across notes, so it can't be replayed
+		if (Sampler::loaded() || config.vibratoDepth != 0.0f) return 0;
+		if (config.filter != Filter::OFF) return 0;
+		const bool square = (config.waveforms & SQUARE) != 0;
+		const bool swept = config.harmonics > 1 || config.partials > 0;
+		if (square && config.dutyRate != 0.0f) return 0;
+		if (swept && config.harmonicVelocity != 0.0f) return 0;
+
+		const int harmonics = config.harmonics, partials = config.partials;
+		const float duty = square ? config.duty : 0.0f;
+		const float offset = swept ? config.harmonicOffset : 0.0f;
+		uint64_t key = RenderCache::SEED;
+		key = RenderCache::hash(key, &config.waveforms, sizeof(config.waveforms));
+		key = RenderCache::hash(key, &harmonics, sizeof(harmonics));
+		key = RenderCache::hash(key, &partials, sizeof(partials));
+		key = RenderCache::hash(key, &duty, sizeof(duty));
+		key = RenderCache::hash(key, &offset, sizeof(offset));
+		key = RenderCache::hash(key, &config.shift, sizeof(config.shift));
+		return key ? key : 1;
+	}
+
+	/* Extend a patch key with the chord being played. */
+	uint64_t voicingKey(uint64_t patch) {
+		uint64_t key = patch;
+		for (int j = 0; j < NUM_CHANNELS; j++) {
+			key = RenderCache::hash(key, &channels[j].freq, sizeof(channels[j].freq));
+			key = RenderCache::hash(key, &channels[j].on, sizeof(channels[j].on));
+		}
+		return key;
+	}
+
+	/* A new chord was struck: restart sampled voices and, if this chord
+	   has been heard before with the same patch, rewind the voices to
+	   where its recording began. */
+	void startNote() {
+		lastNote = config.note;
+		notePosition = 0;
+		for (int j = 0; j < NUM_CHANNELS; j++) {
+			if (channels[j].on) startVoice(j);
+		}
+
+		noteKey = cachedPatch ? voicingKey(cachedPatch) : 0;
+		if (noteKey == 0) {
+			RenderCache::end();
+			return;
+		}
+		float progress[NUM_CHANNELS];
+		for (int j = 0; j < NUM_CHANNELS; j++) progress[j] = channels[j].progress;
+		if (RenderCache::begin(noteKey, progress)) {
+			for (int j = 0; j < NUM_CHANNELS; j++) channels[j].progress = progress[j];
+		}
+	}
+
+	/* Render the active voices before volume and effects. Oscillators are
+	   only rendered here for float output or when filtering; otherwise
+	   the integer path mixes its own. Returns null when there is nothing
+	   in float to mix. */
+	const float * dryVoices(const float offset[NUM_CHANNELS], int length, bool oscillators) {
+		const float mul = (float)(2.0f * M_PI) / SAMPLE_RATE;
+		const bool sampled = Sampler::loaded();
+		const int partials = config.partials;
+		if (!sampled && partials == 0 && !oscillators) return nullptr;
+
+		if ((int)voiceMix.size() < length) voiceMix.resize(length);
+		float * out = voiceMix.data();
+
+		const bool cached = cachedPatch != 0 && voicingKey(cachedPatch) == noteKey;
+		if (cached && RenderCache::read(out, notePosition, length)) {
+			cachedBlocks++;
+			return out;
+		}
+
+		// Filtered voices need a buffer each; otherwise they share one
+		const bool filtered = config.filter != Filter::OFF;
+		float * outs[NUM_CHANNELS];
+		if (filtered) {
+			if ((int)voiceLanes.size() < NUM_CHANNELS * length) 
+				voiceLanes.resize(NUM_CHANNELS * length);
+			std::fill(voiceLanes.begin(), voiceLanes.begin() + NUM_CHANNELS * length, 0.0f);
+			for (int j = 0; j < NUM_CHANNELS; j++) outs[j] = voiceLanes.data() + j * length;
+		}
+		else {
+			std::fill(out, out + length, 0.0f);
+			for (int j = 0; j < NUM_CHANNELS; j++) outs[j] = out;
+			Filter::bypass();
+		}
+
+		if (sampled || partials > 0) {
+			if (!sampled) {
+				Additive::computeSpectrum(spectrum, config.waveforms, 
+					config.duty, config.harmonicOffset, partials);
+			}
+			for (int j = 0; j < NUM_CHANNELS; j++) {
+				if (channels[j].active) {
+					const float freq = channels[j].freq / 2.0f + config.shift;
+					if (sampled) {
+						Sampler::render(j, outs[j], length, freq);
+					}
+					else {
+						Additive::render(outs[j], length, 
+							freq * offset[j] * mul, freq * mul, spectrum,
+							Additive::partialsBelowNyquist(freq, partials));
+					}
+				}
+			}
+		}
+		else {
+			// Pick the oscillator kernel once for the whole block
+			const int harmonics = config.harmonics;
+			float harms[8];
+			for (int i = 0; i < harmonics; i++) {
+				harms[i] = FastMath::cos(i * config.harmonicOffset + i);
+			}
+			if (harmonics >= 1 && harmonics <= 8) {
+				KERNELS[(config.waveforms & 0b1111) * 8 + harmonics - 1](
+					outs, length, offset, harms);
+			}
+		}
+
+		if (filtered) {
+			Filter::Settings settings;
+			settings.type = config.filter;
+			settings.cutoff = config.cutoff;
+			settings.resonance = config.resonance;
+			settings.envAmount = config.filterEnv;
+			settings.lfoDepth = config.filterLfoDepth;
+			settings.lfoRate = config.filterLfoRate;
+			settings.envelope = config.volume;
+			Filter::process(settings, outs, NUM_CHANNELS, out, length);
+		}
+
+		if (cached) RenderCache::write(out, notePosition, length);
+		return out;
+	}
+
+	template <typename T>
+	void genSamples(T * stream, int length) {
+		// Any parameter change invalidates everything recorded so far
+		const uint64_t patch = patchKey();
+		if (patch != cachedPatch) {
+			RenderCache::clear();
+			cachedPatch = patch;
+		}
+		if (config.note != lastNote) startNote();
 
 		// Calculate where to begin in the waveform
-		int offset[NUM_CHANNELS];
+		float offset[NUM_CHANNELS] = {};
 		for (int i = 0; i < NUM_CHANNELS; i++) {
-			if (channels[i].on) {
-				offset[i] = (int) (channels[i].progress * SAMPLE_RATE / 
-					(channels[i].freq / 2.0f + config.shift));
+			const float freq = channels[i].freq / 2.0f + config.shift;
+			if (channels[i].on && freq > 0.0f) {
+				offset[i] = channels[i].progress * SAMPLE_RATE / freq;
 			}
 		}
 
-		float harms[8];
-		for (int i = 0; i < config.harmonics; i++) {
-			harms[i] = cosLookup(i * config.harmonicOffset + i);
+		// Skip voices the envelope has silenced
+		bool anyActive = false;
+		for (int j = 0; j < NUM_CHANNELS; j++) {
+			channels[j].active = channels[j].on && config.volume > SILENCE;
+			anyActive |= channels[j].active;
 		}
 
-		for (int i = 0; i < length; i ++) {
-			float mix = 0.0f;
-			for (int j = 0; j < NUM_CHANNELS; j++) {
-				if (channels[j].on) {
-					const float x = (channels[j].freq / 2.0f + config.shift)
-						* (offset[j] + i) * mul;
-					mix += waveHarmonics(x, config.waveforms, config.harmonics, harms);
+		// Nothing to mix and the reverb has died out
+		if (!anyActive && reverbIdle) {
+			std::fill(stream, stream + length, (T)0);
+			advanceProgress(offset, length);
+			notePosition += length;
+			return;
+		}
+
+		const float * voices = anyActive ?
+			dryVoices(offset, length, std::is_same<T, float>::value 
+				|| config.filter != Filter::OFF) : nullptr;
+		mixBlock(stream, length, offset, voices);
+
+		// Once a full delay line of silence has gone by, the tail is done.
+		// Clear what's left so it can't creep back in when voices resume.
+		quietSamples = std::min(quietSamples, REVERB_SAMPLES);
+		const bool idle = quietSamples == REVERB_SAMPLES;
+		if (idle && !reverbIdle) {
+			std::fill(reverb<T>, reverb<T> + REVERB_SAMPLES, (T)0);
+		}
+		reverbIdle = idle;
+
+		advanceProgress(offset, length);
+		notePosition += length;
+	}
+
+	template void genSamples<float>(float * stream, int length);
+	template void genSamples<int16_t>(int16_t * stream, int length);
+
+	template <typename T> struct AudioFormat;
+	template <> struct AudioFormat<float> { static const SDL_AudioFormat value = AUDIO_F32; };
+	template <> struct AudioFormat<int16_t> { static const SDL_AudioFormat value = AUDIO_S16; };
+
+	void schedule(uint64_t clock, uint8_t status, uint8_t data1, uint8_t data2) {
+		Midi::Message message;
+		message.status = status;
+		message.data1 = data1;
+		message.data2 = data2;
+		// Full up: play it as soon as possible
+		if (scheduledCount == MAX_SCHEDULED) {
+			Midi::apply(message);
+			return;
+		}
+		int i = scheduledCount++;
+		for (; i > 0 && scheduled[i - 1].clock > clock; i--) {
+			scheduled[i] = scheduled[i - 1];
+		}
+		scheduled[i] = { clock, message };
+	}
+
+	/* Render part of a block, advancing the clock. */
+	void renderPart(Sample * out, int length) {
+		if (length <= 0) return;
+		if (noteEnvelope) attackRelease();
+		genSamples(out, length);
+		frameClock += length;
+	}
+
+	/* Render one block and account for it. Called with the synth locked,
+	   by whichever thread renders. MIDI that arrived up to a block ago is
+	   placed a block after its arrival; the block is split wherever a
+	   message lands. */
+	void renderBlock(Sample * out, int length) {
+		const auto start = std::chrono::steady_clock::now();
+		const uint64_t first = frameClock;
+
+		Midi::Event events[64];
+		const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			start.time_since_epoch()).count();
+		for (int n; (n = Midi::receive(events, 64)) > 0;) {
+			for (int i = 0; i < n; i++) {
+				const int64_t late = (now - events[i].arrival) * SAMPLE_RATE / 1000000000;
+				const int64_t at = std::max<int64_t>(0, length - 1 - late);
+				const Midi::Message & m = events[i].message;
+				schedule(first + at, m.status, m.data1, m.data2);
+			}
+		}
+
+		int done = 0;
+		int applied = 0;
+		while (applied < scheduledCount && scheduled[applied].clock < first + length) {
+			const int at = (int)std::max<int64_t>(done, (int64_t)(scheduled[applied].clock - first));
+			renderPart(out + done, at - done);
+			done = at;
+			Midi::apply(scheduled[applied].message);
+			noteEnvelope = true;
+			applied++;
+		}
+		if (applied > 0) {
+			std::copy(scheduled + applied, scheduled + scheduledCount, scheduled);
+			scheduledCount -= applied;
+		}
+		renderPart(out + done, length - done);
+
+		const uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count();
+		blocks++;
+		renderTotal += ns;
+		if (ns > renderMax) renderMax = ns;
+		outputHash = RenderCache::hash(outputHash, out, length * sizeof(Sample));
+	}
+
+	void callback(void *, Uint8 * stream, int length) {
+		if (!callbackEntered) {
+			Realtime::enterAudioThread();
+			callbackEntered = true;
+		}
+		std::lock_guard<Realtime::Mutex> guard(renderMutex);
+		renderBlock((Sample *)stream, length / (int)sizeof(Sample));
+	}
+
+	/* Move the watermark by delta frames, kept between one and MAX_AHEAD
+	   device buffers. Both threads adjust it, so it never blocks. */
+	void adjustWatermark(int delta) {
+		int current = watermark;
+		int next;
+		do {
+			next = std::max(frames, std::min(current + delta, frames * MAX_AHEAD));
+		} while (next != current && !watermark.compare_exchange_weak(current, next));
+	}
+
+	/* With a render thread the device only copies out of the ring. A
+	   short ring is an underrun; one left with less than a buffer to
+	   spare is a near miss. Either way the render thread is told to
+	   work further ahead. */
+	void ringCallback(void *, Uint8 * stream, int length) {
+		Sample * out = (Sample *)stream;
+		const int count = length / (int)sizeof(Sample);
+		const int got = ring.read(out, count);
+		if (got < count) {
+			std::fill(out + got, out + count, (Sample)0);
+			underruns++;
+			adjustWatermark(2 * frames);
+		}
+		else if (ring.size() < frames) {
+			nearMisses++;
+			adjustWatermark(frames);
+		}
+	}
+
+	/* Keep the ring filled to the watermark, a device buffer at a time.
+	   Sleeps are coarse on some platforms, which the watermark absorbs.
+	   After a calm stretch the watermark is lowered again. */
+	void renderLoop() {
+		Realtime::enterAudioThread();
+		std::vector<Sample> block(frames);
+		const unsigned calmBlocks = (unsigned)(CALM_TIME * SAMPLE_RATE / frames);
+		unsigned calm = 0, misses = 0;
+		while (rendering) {
+			const unsigned seen = underruns + nearMisses;
+			if (seen != misses) {
+				misses = seen;
+				calm = 0;
+			}
+			if (ring.size() + frames <= watermark) {
+				{
+					std::lock_guard<Realtime::Mutex> guard(renderMutex);
+					renderBlock(block.data(), frames);
 				}
-				// On the last sample, record from 0.0-1.0 the location 
-				// across the current waveform.
-				if (i == length - 1) {
-					const float x = (channels[j].freq / 2.0f + config.shift)
-						* (offset[j] + i + 1) * mul;
-					double dummy;
-					channels[j].progress = (float)std::modf(x / (2.0f * (float)M_PI), &dummy);
+				ring.write(block.data(), frames);
+				if (++calm >= calmBlocks) {
+					adjustWatermark(-frames);
+					calm = 0;
 				}
 			}
-			mix *= config.volume;
-			mix += reverb[reverbFrame] * 0.5f;
-			stream[i] = mix;
-			reverb[reverbFrame] = mix;
-			reverbFrame = (reverbFrame + 1) % REVERB_SAMPLES;
+			else {
+				std::this_thread::sleep_for(std::chrono::microseconds(
+					250000 * frames / SAMPLE_RATE));
+			}
 		}
 	}
 
-	void callback(void *, Uint8 * stream, int length) {
-		genSamples((float *)stream, length / 4);
+	Stats stats() {
+		Stats s;
+		s.frames = frames;
+		s.watermark = renderAhead ? watermark.load() : 0;
+		s.underruns = underruns;
+		s.nearMisses = nearMisses;
+		s.blocks = blocks;
+		s.cachedBlocks = cachedBlocks;
+		s.renderMean = s.blocks ? renderTotal / 1000.0 / s.blocks : 0.0;
+		s.renderMax = renderMax / 1000.0;
+		s.hash = outputHash;
+		return s;
+	}
+
+	void lock() {
+		renderMutex.lock();
 	}
 
-	void init() {
+	void unlock() {
+		renderMutex.unlock();
+	}
+
+	uint64_t clock() {
+		return frameClock;
+	}
+
+	long ticks() {
+		return (long)(frameClock * 1000 / SAMPLE_RATE);
+	}
+
+	/* Size the voice buffers for the device's blocks up front, so the
+	   audio thread never allocates, and fault in and lock everything it
+	   touches. */
+	void prefault() {
+		voiceMix.resize(frames);
+		voiceLanes.resize(NUM_CHANNELS * frames);
+		Realtime::prefault(voiceMix.data(), voiceMix.size() * sizeof(float), "voice mix");
+		Realtime::prefault(voiceLanes.data(), voiceLanes.size() * sizeof(float), "voice lanes");
+		Realtime::prefault(reverb<Sample>, sizeof(reverb<Sample>), "reverb");
+		Realtime::prefault(FastMath::SIN_TABLE, sizeof(FastMath::SIN_TABLE), "sine table");
+		Realtime::prefault(FastMath::COS_TABLE, sizeof(FastMath::COS_TABLE), "cosine table");
+		Realtime::prefault(Fixed::SIN_TABLE, sizeof(Fixed::SIN_TABLE), "fixed sine table");
+		if (renderAhead) {
+			Realtime::prefault(ring.data(), ring.capacity() * sizeof(Sample), "output ring");
+		}
+		RenderCache::prefault();
+		Sampler::prefault();
+		Realtime::lockMemory();
+	}
+
+	void prepare() {
+		RenderCache::init();
+		for (int i = 0; i < REVERB_SAMPLES; i++) reverb<Sample>[i] = 0;
+		FastMath::computeTables();
+		Fixed::computeTables();
+	}
+
+	void initHeadless(int length) {
+		prepare();
+		headless = true;
+		frames = length;
+		voiceMix.resize(frames);
+		voiceLanes.resize(NUM_CHANNELS * frames);
+	}
+
+	void init(int requested) {
 		if (SDL_Init(SDL_INIT_AUDIO) < 0) {
 			std::cout << "SDL_Init failed: " << SDL_GetError() << std::endl;
 		}
 
+		prepare();
+
+		renderAhead = requested > 0;
+		frames = renderAhead ? std::max(MIN_SAMPLES, std::min(requested, SAMPLES)) : SAMPLES;
+
 		// Initialize SDL audio specifications
 		SDL_AudioSpec desired;
 		desired.freq = SAMPLE_RATE;
-		desired.format = AUDIO_F32;
+		desired.format = AudioFormat<Sample>::value;
 		desired.channels = 1;
-		desired.samples = SAMPLES;
-		desired.callback = callback;
+		desired.samples = (Uint16)frames;
+		desired.callback = renderAhead ? ringCallback : callback;
 
 		SDL_AudioSpec obtained;
 		device = SDL_OpenAudioDevice(
@@ -157,25 +681,49 @@ namespace Synth {
 		if (device == 0) {
 			std::cout << "SDL_OpenAudioDevice failed: " << SDL_GetError() << std::endl;
 		}
+		else {
+			frames = obtained.samples;
+		}
 
-		SDL_PauseAudioDevice(device, 0);
+		// Room for the most that is ever queued
+		if (renderAhead) ring.resize(frames * (MAX_AHEAD + 1));
+		if (Realtime::enabled()) prefault();
 
-		for (int i = 0; i < REVERB_SAMPLES; i++) reverb[i] = 0.0f;
+		// Start two buffers ahead
+		if (renderAhead) {
+			watermark = 2 * frames;
+			rendering = true;
+			renderer = std::thread(renderLoop);
+			while (ring.size() < watermark) SDL_Delay(1);
+		}
 
-		computeSinCos();
+		SDL_PauseAudioDevice(device, 0);
 	}
 
 	void destroy() {
+		if (renderAhead) {
+			rendering = false;
+			renderer.join();
+		}
+		Sampler::destroy();
+		if (headless) return;
 		SDL_CloseAudioDevice(device);
 		SDL_Quit();
 	}
 
 	void resetNote() {
-		config.startTime = SDL_GetTicks();
+		config.startTime = ticks();
+		config.note++;
+	}
+
+	void startVoice(int channel) {
+		if (Sampler::loaded()) {
+			Sampler::trigger(channel, channels[channel].freq / 2.0f + config.shift);
+		}
 	}
 
 	void attackRelease() {
-		const float time = (SDL_GetTicks() - config.startTime) / 1000.0f;
+		const float time = (ticks() - config.startTime) / 1000.0f;
 		if (time >= config.attack) {
 			float releaseTime = time - config.attack;
 			config.volume = std::max(0.0f, (config.release - releaseTime) / config.release);
@@ -186,8 +734,8 @@ namespace Synth {
 	}
 
 	void vibrato() {
-		const float seconds = SDL_GetTicks() / 1000.0f;
-		config.shift = config.vibratoDepth * std::sinf(
+		const float seconds = ticks() / 1000.0f;
+		config.shift = config.vibratoDepth * FastMath::sin(
 			config.vibratoRate * seconds * 2 * (float)M_PI);
 	}
 
@@ -200,8 +748,8 @@ namespace Synth {
 			config.duty = config.dutyOffset;
 		}
 		else {
-			const float seconds = SDL_GetTicks() / 1000.0f;
-			config.duty = 0.5f + 0.4f * std::sinf(
+			const float seconds = ticks() / 1000.0f;
+			config.duty = 0.5f + 0.4f * FastMath::sin(
 				config.dutyRate * seconds * 2 * (float)M_PI);
 		}
 	}
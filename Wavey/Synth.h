@@ -1,13 +1,7 @@
 #ifndef SYNTH_H
 #define SYNTH_H
 #include <atomic>
-
-namespace Waveform {
-	float sin(float x);
-	float square(float x, float duty);
-	float sawtooth(float x);
-	float triangle(float x);
-}
+#include <cstdint>
 
 namespace Synth {
 	constexpr int SAMPLE_RATE = 44100;
@@ -21,6 +15,8 @@ namespace Synth {
 		float freq = 0.0f;
 		bool on = true;
 		float progress = 0.0f;
+		// audible this block (on and not enveloped to silence)
+		bool active = false;
 	};
 	/*
 		0 - root
@@ -33,8 +29,10 @@ namespace Synth {
 	extern Channel channels[NUM_CHANNELS];
 
 	struct Config {
-		// SDL millis of attack
+		// clock millis of attack
 		long startTime = 0;
+		// incremented on every attack
+		std::atomic<unsigned> note = 0;
 		// master volume
 		float volume = 1.0f;
 		// modulate harmonic amplitudes
@@ -48,6 +46,8 @@ namespace Synth {
 			dutyRate = 0.0f;
 		// number of harmonics to mix
 		std::atomic<int> harmonics = 1;
+		// number of additive partials per voice (0 = off)
+		std::atomic<int> partials = 0;
 		// update harmonic offset 
 		std::atomic<float> harmonicVelocity = 0.2f;
 		// Depth and rate in Hz
@@ -56,13 +56,67 @@ namespace Synth {
 		std::atomic<float> attack = 0.2f, 
 			release = 1.25f;
 		unsigned char waveforms = SINE;
+		// voice filter (Filter::Type), cutoff in Hz, resonance 0.0-1.0
+		std::atomic<int> filter = 0;
+		std::atomic<float> cutoff = 2000.0f,
+			resonance = 0.2f;
+		// cutoff modulation in octaves by the envelope, and an LFO
+		// of given depth (octaves) and rate (Hz)
+		std::atomic<float> filterEnv = 0.0f,
+			filterLfoDepth = 0.0f,
+			filterLfoRate = 0.0f;
 	};
 	extern Config config;
+	// reverb tail has decayed to silence
+	extern bool reverbIdle;
+
+	/* Device sample format. Define WAVEY_FIXED_POINT to render with
+	   integer math into a 16-bit device. */
+#ifdef WAVEY_FIXED_POINT
+	typedef int16_t Sample;
+#else
+	typedef float Sample;
+#endif
+	template <typename T> void genSamples(T * stream, int length);
 
-	void init();
+	/* Output counters. With a render thread, the watermark is how many
+	   frames it keeps queued ahead of the device. Render times are the
+	   wall time spent in genSamples per block, and the hash is FNV-1a
+	   over every sample produced. */
+	struct Stats {
+		int frames = 0;
+		int watermark = 0;
+		unsigned underruns = 0, nearMisses = 0;
+		// blocks (or parts) whose dry voices came from the render cache
+		uint64_t blocks = 0, cachedBlocks = 0;
+		double renderMean = 0.0, renderMax = 0.0;
+		uint64_t hash = 0;
+	};
+	Stats stats();
+
+	/* frames = 0 renders the default buffer inside the device callback.
+	   Otherwise the device buffer is that many frames (64-128 for low
+	   latency) and a render thread stays ahead of it. */
+	void init(int frames = 0);
+	// No device; blocks are pulled with renderBlock instead
+	void initHeadless(int frames);
+	void renderBlock(Sample * out, int length);
 	void destroy();
+	// Play a MIDI message when the clock reaches the given frame
+	void schedule(uint64_t clock, uint8_t status, uint8_t data1, uint8_t data2);
+	// Hold off rendering while changing channels or config
+	void lock();
+	void unlock();
+
+	/* Frames rendered so far. Everything timed in the synth runs off
+	   this rather than the wall clock, so a session replays exactly. */
+	uint64_t clock();
+	// clock in milliseconds
+	long ticks();
 
 	void resetNote();
+	// Start one channel's voice alone, leaving the envelope as it is
+	void startVoice(int channel);
 	void duty();
 	void attackRelease();
 	void vibrato();
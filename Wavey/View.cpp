@@ -5,6 +5,9 @@
 #include <assert.h>
 #include "Synth.h"
 #include "Notes.h"
+#include "Sampler.h"
+#include "Filter.h"
+#include "Realtime.h"
 
 /* To string with precision.
    Courtesy of https://stackoverflow.com/questions/16605967/. */
@@ -102,6 +105,17 @@ namespace View {
 		write(to_string_prec(Synth::config.dutyRate.load(), 2).c_str(), x + 16, y + 6);
 	}
 
+	void drawFilter(int x, int y) {
+		const std::string line = std::string("filter=") + Filter::name(Synth::config.filter)
+			+ " cutoff=" + to_string_prec(Synth::config.cutoff.load(), 0)
+			+ " res=" + to_string_prec(Synth::config.resonance.load(), 2)
+			+ " env=" + to_string_prec(Synth::config.filterEnv.load(), 2)
+			+ " lfo=" + to_string_prec(Synth::config.filterLfoDepth.load(), 2)
+			+ "@" + to_string_prec(Synth::config.filterLfoRate.load(), 2);
+		// Never past the border
+		write(line.substr(0, WIDTH - 1 - x).c_str(), x, y);
+	}
+
 	// Map inversion number to order of notes played
 	constexpr int INVERSIONS[5][5] = {
 		{ 0, 1, 2, 3, 4 },
@@ -145,11 +159,19 @@ namespace View {
 			<< "bpm      <n> -- Set beats per minute" << std::endl
 			<< "harm     <n> -- Number of harmonics of frequency to mix (1-8)" << std::endl
 			<< "harm mod <f> -- Modulate amplitude of harmonics at given frequency" << std::endl
+			<< "partials <n> -- Band-limited partials per voice (0 = off, up to 256)" << std::endl
 			<< "duty     <w> -- Square wave width (0.0-1.0)" << std::endl
 			<< "duty mod <f> -- Modulate square wave width at given frequency" << std::endl
 			<< "attack   <t> -- Length of volume attack in seconds" << std::endl
 			<< "release  <t> -- Length of volume release in seconds" << std::endl
+			<< "sampler  <f> -- Play voices from an instrument mapping file ('off' to stop)" << std::endl
+			<< "filter   <t> -- Voice filter: svf, ladder or off" << std::endl
+			<< "cutoff   <f> -- Filter cutoff in Hz" << std::endl
+			<< "res      <r> -- Filter resonance (0.0-1.0)" << std::endl
+			<< "fenv     <d> -- Sweep cutoff by d octaves with the envelope" << std::endl
+			<< "flfo <d> <f> -- Sweep cutoff by d octaves at given frequency" << std::endl
 			<< "vibe <d> <f> -- Vibrato at depth (in Hz) at given frequency" << std::endl
+			<< "stats        -- Show audio buffer size, latency and dropouts" << std::endl
 			<< "sin          -- Toggle sine wave" << std::endl
 			<< "sqr          -- Toggle square wave" << std::endl
 			<< "saw          -- Toggle sawtooth wave" << std::endl
@@ -162,6 +184,43 @@ namespace View {
 			<< "exit/quit    -- Quit this program" << std::endl;
 	}
 
+	void stats() {
+		const Synth::Stats s = Synth::stats();
+		const float ms = 1000.0f / Synth::SAMPLE_RATE;
+		std::cout
+			<< "buffer            = " << s.frames << " frames (" 
+			<< to_string_prec(s.frames * ms, 1) << " ms)" << std::endl;
+		if (s.watermark > 0) {
+			std::cout
+				<< "render ahead      = " << s.watermark << " frames ("
+				<< to_string_prec(s.watermark * ms, 1) << " ms)" << std::endl
+				<< "underruns         = " << s.underruns << std::endl
+				<< "near misses       = " << s.nearMisses << std::endl;
+		}
+		std::cout
+			<< "sampler underruns = " << Sampler::underruns() << std::endl
+			<< "blocks rendered   = " << s.blocks << std::endl
+			<< "cached blocks     = " << s.cachedBlocks << std::endl
+			<< "render (us)       = " << to_string_prec(s.renderMean, 1) << " mean, "
+			<< to_string_prec(s.renderMax, 1) << " max" << std::endl
+			<< "output hash       = " << std::hex << s.hash << std::dec << std::endl;
+		realtime();
+	}
+
+	/* What the realtime profile, if on, could not get. */
+	void realtime() {
+		if (!Realtime::enabled()) return;
+		const auto failures = Realtime::failures();
+		if (failures.empty()) {
+			std::cout << "Realtime profile: everything obtained." << std::endl;
+			return;
+		}
+		std::cout << "Realtime profile, not obtained:" << std::endl;
+		for (const auto & f : failures) {
+			std::cout << "  " << f << std::endl;
+		}
+	}
+
 	void render(const std::vector<Chord> & prog, int bpm) {
 		clear();
 
@@ -184,6 +243,11 @@ namespace View {
 		write(to_string_prec(Synth::config.vibratoDepth.load(), 2).c_str(), 78, 2);
 		write("vibe mod (Hz)   = ", 59, 4);
 		write(to_string_prec(Synth::config.vibratoRate.load(), 2).c_str(), 78, 4);
+		write("partials        = ", 59, 6);
+		write(std::to_string(Synth::config.partials).c_str(), 78, 6);
+		write("sampler         = ", 59, 8);
+		write(Sampler::loaded() ? "on" : "off", 78, 8);
+		drawFilter(14, 21);
 
 		for (int y = 0; y < HEIGHT; y++) {
 			for (int x = 0; x < WIDTH; x++) {
@@ -7,6 +7,8 @@ namespace View {
 	void init();
 	void intro();
 	void help();
+	void stats();
+	void realtime();
 	void render(const std::vector<Chord> & prog, int bpm);
 }
 
@@ -5,13 +5,24 @@
 #include <thread>
 #include <vector>
 #include <map>
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <ctime>
+#include <chrono>
+#include <fstream>
 #include <SDL.h>
 #include "Notes.h"
 #include "Chord.h"
+#include "ChordModel.h"
 #include "Synth.h"
+#include "Additive.h"
+#include "Sampler.h"
+#include "Filter.h"
+#include "Realtime.h"
+#include "Session.h"
+#include "Midi.h"
+#include "Control.h"
 #include "View.h"
 
 std::vector<Chord> progression;
@@ -76,12 +87,15 @@ Chord closest(const Chord & c, int root, Chord::Type type) {
 	return best;
 }
 
-/* Randomly choose the next chord in the progression given 
-   the defined transition graph. */
-Chord nextChord(const Chord & c) {
-	Chord::Type type = c.type;
-	const auto & options = transitions.at(type);
-	const auto & trans = options.at(rand() % options.size());
+/* Randomly choose the next chord in the progression from the
+   trained table if one is loaded, else from the defined transition
+   graph. */
+Chord nextChord(const Chord & c, const Chord * previous = nullptr) {
+	Transition trans;
+	if (!ChordModel::next(previous, c, trans)) {
+		const auto & options = transitions.at(c.type);
+		trans = options.at(rand() % options.size());
+	}
 	const int root = Notes::middleOctave(c.root + trans.dist);
 	return closest(c, root, trans.newType);
 }
@@ -96,26 +110,22 @@ void assignChord(const Chord & c) {
 
 /* Toggle the given channel from being mixed. */
 void toggleChannel(int channel) {
-	SDL_LockAudio();
 	Synth::channels[channel].on ^= true;
-	SDL_UnlockAudio();
 }
 
 /* Toggle the given waveform(s) from the synthesizer. */
 void toggleWaveform(int wave) {
-	SDL_LockAudio();
 	if (Synth::config.waveforms & wave)
 		Synth::config.waveforms ^= wave;
 	else
 		Synth::config.waveforms |= wave;
-	SDL_UnlockAudio();
 }
 
 /* Starts playing the measure from the beginning. */
 std::atomic<int> lastBeat = 0;
 std::atomic<float> measureStart = 0;
 void resetMeasure() {
-	measureStart = SDL_GetTicks() / 1000.0f;
+	measureStart = Synth::ticks() / 1000.0f;
 	lastBeat = -1;
 }
 
@@ -129,7 +139,8 @@ void updateProgression() {
 		Chord c = randomChord();
 		progression.push_back(c);
 		for (int i = 0; i < beatsPerMeasure - 1; i++) {
-			c = nextChord(c);
+			const Chord * previous = i > 0 ? &progression.at(i - 1) : nullptr;
+			c = nextChord(c, previous);
 			progression.push_back(c);
 		}
 		newProgression = false;
@@ -140,9 +151,10 @@ void updateProgression() {
 /* Update to the next chord depending on the bpm. */
 float bps = 45.0f / 60.0f;
 void updateChord() {
-	if (progression.size() == 0) return;
+	// MIDI plays the voices instead
+	if (progression.size() == 0 || Midi::ownsVoices()) return;
 
-	const int currentBeat = (int) ((SDL_GetTicks() / 1000.0f - measureStart) * bps);
+	const int currentBeat = (int) ((Synth::ticks() / 1000.0f - measureStart) * bps);
 	if (currentBeat > lastBeat) {
 		const auto & c = progression.at(currentBeat % progression.size());
 		assignChord(c);
@@ -153,229 +165,618 @@ void updateChord() {
 
 /* Update synth properties periodically. */
 void updateSynth() {
-	SDL_LockAudio();
 	Synth::duty();
 	Synth::harmonics();
 	Synth::attackRelease();
 	Synth::vibrato();
-	SDL_UnlockAudio();
+}
+
+/* One control update, applied at a single block boundary. */
+void tick() {
+	Synth::lock();
+	Session::record("tick");
+	updateProgression();
+	updateChord();
+	updateSynth();
+	Synth::unlock();
 }
 
 /* Control audio in separate thread. */
+unsigned seed = 0;
 std::atomic<bool> audioRunning = true;
+std::atomic<bool> controlStarted = false;
 void control() {
+	Realtime::enterControlThread();
+	controlStarted = true;
 	// seed random in thread 'cause Microsoft
-	srand((unsigned int)time(NULL));
+	srand(seed);
 	while (audioRunning) {
-		updateProgression();
-		updateChord();
-		updateSynth();
+		tick();
+		Session::flush();
 		std::this_thread::sleep_for(std::chrono::milliseconds(16));
 	}
 }
 
-/* Set some synth defaults. */
-void setDefaults() {
-	// turn off 7th and 9th to begin with
-	toggleChannel(3);
-	toggleChannel(4);
+/* Keep a parameter within its range, noting when it wasn't. */
+float limit(float value, float low, float high, const char * name) {
+	const float limited = std::max(low, std::min(value, high));
+	if (limited != value) {
+		std::cerr << "Note: " << name << " limited to " << low << " - " << high << "." << std::endl;
+	}
+	return limited;
 }
 
-int main(int argc, char * argv[])
-{
-	srand((unsigned int)time(NULL)); 
-	Notes::computeFreqs();
-	computeTransitions();
-	Synth::init();
-	View::init();
-
-	std::thread controller(control);
-
-	setDefaults();
-
-	View::intro();
-
-	while (true) {
-
-		std::string input;
-		std::getline(std::cin, input);
-		if (input.length() == 0) continue;
-
-		std::istringstream iss(input);
-		const std::vector<std::string> tokens{
-			std::istream_iterator<std::string>{iss},
-			std::istream_iterator<std::string>{} };
-		const std::string & cmd = tokens.at(0);
-		if (cmd == "help") {
-			View::help();
-			continue;
+bool dispatch(const std::vector<std::string> & tokens) {
+	const std::string & cmd = tokens.at(0);
+	if (cmd == "new" || cmd == "n") {
+		newProgression = true;
+		resetMeasure();
+	}
+	/* beats n */
+	else if (cmd == "beats") {
+		if (tokens.size() != 2) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
 		}
-		else if (cmd == "new" || cmd == "n") {
+		try {
+			int beats = std::stoi(tokens.at(1));
+			if (beats < 1) {
+				std::cerr << "Must have a positive number of beats." << std::endl;
+				return false;
+			}
+			if (beats > 5) {
+				std::cerr << "Note: beats limited to 5." << std::endl;
+				beats = 5;
+			}
+			beatsPerMeasure = beats;
 			newProgression = true;
 			resetMeasure();
 		}
-		/* beats n */
-		else if (cmd == "beats") {
-			if (tokens.size() != 2) {
-				std::cerr << "Invalid number of parameters." << std::endl;
-				continue;
+		catch (std::exception &) {
+			std::cerr << "Could not understand '" << tokens.at(1) << "'." << std::endl;
+			return false;
+		}
+	}
+	/* bpm n */
+	else if (cmd == "bpm") {
+		if (tokens.size() != 2) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
+		}
+		try {
+			int bpm = std::stoi(tokens.at(1));
+			bps = bpm / 60.0f;
+			resetMeasure();
+		}
+		catch (std::exception &) {
+			std::cerr << "Could not understand '" << tokens.at(1) << "'." << std::endl;
+			return false;
+		}
+	}
+	/* harm n 
+	   harm mod rate (Hz)
+	*/
+	else if (cmd == "harm") {
+		if (tokens.size() != 2 && !(tokens.size() == 3 && tokens.at(1) == "mod")) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
+		}
+		if (tokens.at(1) == "mod") {
+			float harmv = std::stof(tokens.at(2));
+			Synth::config.harmonicVelocity = harmv;
+		}
+		else {
+			int harms = std::stoi(tokens.at(1));
+			if (harms > 8) {
+				std::cerr << "Note: harmonics limited to 8." << std::endl;
+				harms = 8;
 			}
-			try {
-				int beats = std::stoi(tokens.at(1));
-				if (beats < 1) {
-					std::cerr << "Must have a positive number of beats." << std::endl;
-					continue;
-				}
-				if (beats > 5) {
-					std::cerr << "Note: beats limited to 5." << std::endl;
-					beats = 5;
-				}
-				beatsPerMeasure = beats;
-				newProgression = true;
-				resetMeasure();
+			Synth::config.harmonics = harms;
+		}
+	}
+	/* partials n */
+	else if (cmd == "partials") {
+		if (tokens.size() != 2) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
+		}
+		try {
+			int partials = std::stoi(tokens.at(1));
+			if (partials < 0) {
+				std::cerr << "Must have a non-negative number of partials." << std::endl;
+				return false;
 			}
-			catch (std::exception &) {
-				std::cerr << "Could not understand '" << tokens.at(1) << "'." << std::endl;
-				continue;
+			if (partials > Additive::MAX_PARTIALS) {
+				std::cerr << "Note: partials limited to " 
+					<< Additive::MAX_PARTIALS << "." << std::endl;
+				partials = Additive::MAX_PARTIALS;
 			}
+			Synth::config.partials = partials;
+		}
+		catch (std::exception &) {
+			std::cerr << "Could not understand '" << tokens.at(1) << "'." << std::endl;
+			return false;
+		}
+	}
+	/* sampler mapfile
+	   sampler off
+	*/
+	else if (cmd == "sampler") {
+		if (tokens.size() != 2) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
+		}
+		if (tokens.at(1) == "off") {
+			Sampler::unload();
+		}
+		else if (!Sampler::load(tokens.at(1))) {
+			return false;
+		}
+	}
+	/* filter svf/ladder/off */
+	else if (cmd == "filter") {
+		if (tokens.size() != 2) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
+		}
+		int type = Filter::NUM_TYPES;
+		for (int i = 0; i < Filter::NUM_TYPES; i++) {
+			if (tokens.at(1) == Filter::name(i)) type = i;
+		}
+		if (type == Filter::NUM_TYPES) {
+			std::cerr << "Unknown filter '" << tokens.at(1) << "'." << std::endl;
+			return false;
+		}
+		Synth::config.filter = type;
+	}
+	/* fenv depth (octaves) */
+	else if (cmd == "fenv") {
+		if (tokens.size() != 2) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
+		}
+		try {
+			Synth::config.filterEnv = limit(std::stof(tokens.at(1)),
+				-Filter::MAX_OCTAVES, Filter::MAX_OCTAVES, "envelope depth");
+		}
+		catch (std::exception &) {
+			std::cerr << "Could not understand '" << tokens.at(1) << "'." << std::endl;
+			return false;
+		}
+	}
+	/* flfo depth (octaves) rate (Hz) */
+	else if (cmd == "flfo") {
+		if (tokens.size() != 3) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
+		}
+		try {
+			const float depth = limit(std::stof(tokens.at(1)),
+				-Filter::MAX_OCTAVES, Filter::MAX_OCTAVES, "LFO depth");
+			const float rate = limit(std::stof(tokens.at(2)), 0.0f, Filter::MAX_LFO_RATE, "LFO rate");
+			Synth::config.filterLfoDepth = depth;
+			Synth::config.filterLfoRate = rate;
+		}
+		catch (std::exception &) {
+			std::cerr << "Could not understand '" << tokens.at(1) << ' ' << tokens.at(2) << "'." << std::endl;
+			return false;
+		}
+	}
+	/* cutoff f (Hz) */
+	else if (cmd == "cutoff") {
+		if (tokens.size() != 2) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
 		}
-		/* bpm n */
-		else if (cmd == "bpm") {
+		try {
+			Synth::config.cutoff = limit(std::stof(tokens.at(1)),
+				Filter::MIN_CUTOFF, Filter::MAX_CUTOFF, "cutoff");
+		}
+		catch (std::exception &) {
+			std::cerr << "Could not understand '" << tokens.at(1) << "'." << std::endl;
+			return false;
+		}
+	}
+	/* res r (0.0-1.0) */
+	else if (cmd == "res") {
+		if (tokens.size() != 2) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
+		}
+		try {
+			Synth::config.resonance = limit(std::stof(tokens.at(1)), 0.0f, 1.0f, "resonance");
+		}
+		catch (std::exception &) {
+			std::cerr << "Could not understand '" << tokens.at(1) << "'." << std::endl;
+			return false;
+		}
+	}
+	/* vibe depth (Hz) rate (Hz) */
+	else if (cmd == "vibe") { // TODO: default
+		if (tokens.size() != 3) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
+		}
+		const float depth = std::stof(tokens.at(1));
+		const float rate  = std::stof(tokens.at(2));
+		Synth::config.vibratoDepth = depth;
+		Synth::config.vibratoRate = rate;
+	}
+	/* duty width 
+	   duty mod rate (Hz)
+	*/
+	else if (cmd == "duty") {
+		if (tokens.size() == 1) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
+		}
+		if (tokens.at(1) == "mod") {
+			if (tokens.size() != 3) {
+				std::cerr << "Invalid number of parameters." << std::endl;
+				return false;
+			}
+			float rate = std::stof(tokens.at(2));
+			Synth::config.dutyRate = rate;
+		}
+		else {
 			if (tokens.size() != 2) {
 				std::cerr << "Invalid number of parameters." << std::endl;
-				continue;
+				return false;
 			}
 			try {
-				int bpm = std::stoi(tokens.at(1));
-				bps = bpm / 60.0f;
-				resetMeasure();
+				float duty = std::stof(tokens.at(1));
+				Synth::config.dutyOffset = duty;
 			}
 			catch (std::exception &) {
 				std::cerr << "Could not understand '" << tokens.at(1) << "'." << std::endl;
-				continue;
+				return false;
 			}
 		}
-		/* harm n 
-		   harm mod rate (Hz)
-		*/
-		else if (cmd == "harm") {
-			if (tokens.at(1) == "mod") {
-				float harmv = std::stof(tokens.at(2));
-				Synth::config.harmonicVelocity = harmv;
+	}
+	/* attack t (s) */
+	else if (cmd == "attack") {
+		if (tokens.size() != 2) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
+		}
+		const float a = std::stof(tokens.at(1));
+		Synth::config.attack = a;
+	}
+	/* release t (s) */
+	else if (cmd == "release") {
+		if (tokens.size() != 2) {
+			std::cerr << "Invalid number of parameters." << std::endl;
+			return false;
+		}
+		const float r = std::stof(tokens.at(1));
+		Synth::config.release = r;
+	}
+	/* Toggle waveforms */
+	else if (cmd == "sin") {
+		toggleWaveform(Synth::SINE);
+	}
+	else if (cmd == "sqr") {
+		toggleWaveform(Synth::SQUARE);
+	}
+	else if (cmd == "saw") {
+		toggleWaveform(Synth::SAWTOOTH);
+	}
+	else if (cmd == "tri") {
+		toggleWaveform(Synth::TRIANGLE);
+	}
+	/* Toggle channels (chord degrees) */
+	else if (cmd == "1") {
+		toggleChannel(0);
+	}
+	else if (cmd == "3") {
+		toggleChannel(1);
+	}
+	else if (cmd == "5") {
+		toggleChannel(2);
+	}
+	else if (cmd == "7") {
+		toggleChannel(3);
+	}
+	else if (cmd == "9") {
+		toggleChannel(4);
+	}
+	else {
+		std::cerr << "Unknown command '" << cmd << "'." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/* Apply one console command; call with the synth locked. Returns
+   false if it was not understood. */
+bool execute(const std::vector<std::string> & tokens) {
+	try {
+		return dispatch(tokens);
+	}
+	catch (std::exception &) {
+		std::cerr << "Could not understand '" << tokens.at(0) << "'." << std::endl;
+		return false;
+	}
+}
+
+/* Do the slow part of a command, reading files, before the synth is
+   locked to apply it. */
+void prepare(const std::vector<std::string> & tokens) {
+	if (tokens.size() == 2 && tokens.at(0) == "sampler" && tokens.at(1) != "off") {
+		Sampler::prepare(tokens.at(1));
+	}
+}
+
+/* Run a command from the console. The whole command is applied at one
+   block boundary, and recorded there if it was understood, so it
+   replays exactly. */
+bool command(const std::vector<std::string> & tokens, const std::string & line) {
+	prepare(tokens);
+	Synth::lock();
+	const bool understood = execute(tokens);
+	if (understood) Session::record("cmd " + line);
+	Synth::unlock();
+	Session::flush();
+	return understood;
+}
+
+/* Set some synth defaults. */
+void setDefaults() {
+	// turn off 7th and 9th to begin with
+	command({ "7" }, "7");
+	command({ "9" }, "9");
+}
+
+/* Command line options:
+	--frames <n>    device buffer in frames, rendered ahead on a thread
+	--realtime      realtime scheduling and locked memory (Linux)
+	--cpus <a>,<c>  CPUs for the audio and control threads
+	--record <f>    record the session to a file
+	--replay <f>    replay a session headlessly, as fast as possible
+	--out <f>       write the replayed audio to a raw file
+	--midi <f>      play MIDI from a FIFO or file ('-' for stdin, which
+	                then replaces the console)
+	--model <t>     pick chords from a trained transition table
+	--socket <f>    take batches of commands on a Unix-domain socket
+	--train <t> <charts...>
+	                train a transition table from chord charts and exit */
+struct Options {
+	int frames = 0;
+	Realtime::Profile realtime;
+	std::string record, replay, out, midi, model, train, socket;
+	std::vector<std::string> charts;
+};
+
+Options parseOptions(int argc, char * argv[]) {
+	Options options;
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		try {
+			if (arg == "--frames" && i + 1 < argc) {
+				options.frames = std::max(0, std::stoi(argv[++i]));
 			}
-			else {
-				int harms = std::stoi(tokens.at(1));
-				if (harms > 8) {
-					std::cerr << "Note: harmonics limited to 8." << std::endl;
-					harms = 8;
-				}
-				SDL_LockAudio();
-				Synth::config.harmonics = harms;
-				SDL_UnlockAudio();
+			else if (arg == "--realtime") {
+				options.realtime.enabled = true;
 			}
-		}
-		/* vibe depth (Hz) rate (Hz) */
-		else if (cmd == "vibe") { // TODO: default
-			if (tokens.size() != 3) {
-				std::cerr << "Invalid number of parameters." << std::endl;
-				continue;
+			else if (arg == "--record" && i + 1 < argc) {
+				options.record = argv[++i];
 			}
-			const float depth = std::stof(tokens.at(1));
-			const float rate  = std::stof(tokens.at(2));
-			Synth::config.vibratoDepth = depth;
-			Synth::config.vibratoRate = rate;
-		}
-		/* duty width 
-		   duty mod rate (Hz)
-		*/
-		else if (cmd == "duty") {
-			if (tokens.size() == 1) {
-				std::cerr << "Invalid number of parameters." << std::endl;
-				continue;
+			else if (arg == "--replay" && i + 1 < argc) {
+				options.replay = argv[++i];
+			}
+			else if (arg == "--out" && i + 1 < argc) {
+				options.out = argv[++i];
+			}
+			else if (arg == "--midi" && i + 1 < argc) {
+				options.midi = argv[++i];
+			}
+			else if (arg == "--socket" && i + 1 < argc) {
+				options.socket = argv[++i];
+			}
+			else if (arg == "--model" && i + 1 < argc) {
+				options.model = argv[++i];
 			}
-			if (tokens.at(1) == "mod") {
-				if (tokens.size() != 3) {
-					std::cerr << "Invalid number of parameters." << std::endl;
-					continue;
+			else if (arg == "--train" && i + 1 < argc) {
+				options.train = argv[++i];
+				options.charts.assign(argv + i + 1, argv + argc);
+				break;
+			}
+			else if (arg == "--cpus" && i + 1 < argc) {
+				const std::string cpus = argv[++i];
+				const size_t comma = cpus.find(',');
+				options.realtime.audioCpu = std::stoi(cpus.substr(0, comma));
+				if (comma != std::string::npos) {
+					options.realtime.controlCpu = std::stoi(cpus.substr(comma + 1));
 				}
-				float rate = std::stof(tokens.at(2));
-				Synth::config.dutyRate = rate;
 			}
 			else {
-				if (tokens.size() != 2) {
-					std::cerr << "Invalid number of parameters." << std::endl;
-					continue;
-				}
-				try {
-					float duty = std::stof(tokens.at(1));
-					SDL_LockAudio();
-					Synth::config.dutyOffset = duty;
-					SDL_UnlockAudio();
-				}
-				catch (std::exception &) {
-					std::cerr << "Could not understand '" << tokens.at(1) << "'." << std::endl;
-					continue;
-				}
+				std::cerr << "Unknown option '" << arg << "'." << std::endl;
 			}
 		}
-		/* attack t (s) */
-		else if (cmd == "attack") {
-			if (tokens.size() != 2) {
-				std::cerr << "Invalid number of parameters." << std::endl;
-				continue;
-			}
-			const float a = std::stof(tokens.at(1));
-			Synth::config.attack = a;
+		catch (std::exception &) {
+			std::cerr << "Could not understand '" << argv[i] << "'." << std::endl;
 		}
-		/* release t (s) */
-		else if (cmd == "release") {
-			if (tokens.size() != 2) {
-				std::cerr << "Invalid number of parameters." << std::endl;
-				continue;
+	}
+	return options;
+}
+
+std::vector<std::string> tokenize(const std::string & line) {
+	std::istringstream iss(line);
+	return { std::istream_iterator<std::string>{iss},
+		std::istream_iterator<std::string>{} };
+}
+
+/* Re-run a recorded session with no device, rendering as fast as
+   possible. Returns non-zero if it can't be run or the audio differs. */
+int replay(const std::string & path, const std::string & audioPath) {
+	Session::Recording recording;
+	if (!Session::load(path, recording)) return 1;
+	if (recording.format != Session::format()) {
+		std::cerr << "Session was recorded with " << recording.format 
+			<< " samples, this build renders " << Session::format() << "." << std::endl;
+		return 1;
+	}
+	seed = recording.seed;
+	srand(seed);
+	Synth::initHeadless(recording.frames);
+	Sampler::setBlocking(true);
+
+	std::ofstream audio;
+	if (!audioPath.empty()) {
+		audio.open(audioPath, std::ios::binary);
+		if (!audio) {
+			std::cerr << "Could not open '" << audioPath << "'." << std::endl;
+			return 1;
+		}
+	}
+	std::vector<Synth::Sample> block(recording.frames);
+	auto renderUntil = [&](uint64_t clock) {
+		while (Synth::clock() < clock) {
+			Synth::renderBlock(block.data(), recording.frames);
+			if (audio.is_open()) {
+				audio.write((const char *)block.data(), block.size() * sizeof(Synth::Sample));
 			}
-			const float r = std::stof(tokens.at(1));
-			Synth::config.release = r;
 		}
-		/* Toggle waveforms */
-		else if (cmd == "sin") {
-			toggleWaveform(Synth::SINE);
+		return Synth::clock() == clock;
+	};
+
+	const auto start = std::chrono::steady_clock::now();
+	for (const auto & e : recording.events) {
+		// MIDI lands inside a block; schedule it before that block renders
+		Midi::Message message;
+		if (e.what != "midi reset" && Midi::parse(e.what, message)) {
+			renderUntil(e.clock - e.clock % recording.frames);
+			Synth::schedule(e.clock, message.status, message.data1, message.data2);
+			continue;
 		}
-		else if (cmd == "sqr") {
-			toggleWaveform(Synth::SQUARE);
+		if (!renderUntil(e.clock)) {
+			std::cerr << "Event at " << e.clock << " is not on a block boundary." << std::endl;
+			return 1;
 		}
-		else if (cmd == "saw") {
-			toggleWaveform(Synth::SAWTOOTH);
+		if (e.what == "tick") {
+			tick();
 		}
-		else if (cmd == "tri") {
-			toggleWaveform(Synth::TRIANGLE);
+		else if (e.what == "midi reset") {
+			Midi::reset();
 		}
-		/* Toggle channels (chord degrees) */
-		else if (cmd == "1") {
-			toggleChannel(0);
+		else if (e.what.compare(0, 6, "model ") == 0) {
+			if (!ChordModel::load(e.what.substr(6))) return 1;
 		}
-		else if (cmd == "3") {
-			toggleChannel(1);
+		else if (e.what.compare(0, 4, "cmd ") == 0) {
+			const std::vector<std::string> tokens = tokenize(e.what.substr(4));
+			if (tokens.empty()) continue;
+			prepare(tokens);
+			Synth::lock();
+			execute(tokens);
+			Synth::unlock();
 		}
-		else if (cmd == "5") {
-			toggleChannel(2);
+	}
+	renderUntil(recording.end);
+	const double wall = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+
+	const double seconds = (double)Synth::clock() / Synth::SAMPLE_RATE;
+	std::cout << "Replayed " << seconds << " s of audio in " << wall << " s ("
+		<< seconds / std::max(wall, 1e-9) << "x realtime)." << std::endl;
+	View::stats();
+	const bool ended = recording.end != 0;
+	const bool identical = ended && Synth::stats().hash == recording.hash;
+	if (ended) {
+		std::cout << (identical ? "Audio matches the recording." 
+			: "Audio differs from the recording.") << std::endl;
+	}
+	else {
+		std::cout << "Session has no end; nothing to compare." << std::endl;
+	}
+	Synth::destroy();
+	return ended && !identical ? 2 : 0;
+}
+
+int main(int argc, char * argv[])
+{
+	seed = (unsigned int)time(NULL);
+	srand(seed); 
+	Notes::computeFreqs();
+	computeTransitions();
+	const Options options = parseOptions(argc, argv);
+	if (!options.train.empty()) {
+		ChordModel::Summary summary;
+		if (!ChordModel::train(options.charts, options.train, 0, summary)) return 1;
+		std::cout << "Trained on " << summary.transitions << " transitions in "
+			<< summary.songs << " songs from " << summary.files << " files in "
+			<< summary.seconds << " s." << std::endl;
+		return summary.unreadable > 0 ? 2 : 0;
+	}
+	if (!options.replay.empty()) {
+		return replay(options.replay, options.out);
+	}
+	if (!options.model.empty() && !ChordModel::load(options.model)) return 1;
+	Realtime::configure(options.realtime);
+	Synth::init(options.frames);
+	View::init();
+	if (!options.record.empty()) {
+		Session::start(options.record, seed, Synth::stats().frames);
+		// Replays need the same table to pick the same chords
+		if (ChordModel::loaded()) {
+			Synth::lock();
+			Session::record("model " + ChordModel::path());
+			Synth::unlock();
+		}
+	}
+
+	std::thread controller(control);
+	while (!controlStarted) SDL_Delay(1);
+
+	setDefaults();
+	if (!options.midi.empty()) Midi::open(options.midi);
+	if (!options.socket.empty()) Control::open(options.socket, prepare, execute);
+
+	View::intro();
+	View::realtime();
+
+	// MIDI on stdin: play until the stream ends and the last note dies away
+	if (options.midi == "-") {
+		while (Midi::running()) SDL_Delay(16);
+		SDL_Delay((Uint32)(Synth::config.release * 1000.0f));
+	}
+
+	while (options.midi != "-") {
+
+		std::string input;
+		if (!std::getline(std::cin, input)) {
+			// No console left; keep going while the socket is driven
+			if (options.socket.empty()) break;
+			SDL_Delay(100);
+			continue;
 		}
-		else if (cmd == "7") {
-			toggleChannel(3);
+		if (input.length() == 0) continue;
+
+		const std::vector<std::string> tokens = tokenize(input);
+		if (tokens.empty()) continue;
+		const std::string & cmd = tokens.at(0);
+		if (cmd == "help") {
+			View::help();
+			continue;
 		}
-		else if (cmd == "9") {
-			toggleChannel(4);
+		if (cmd == "stats") {
+			View::stats();
+			continue;
 		}
 		/* Quit the application */
-		else if (cmd == "exit" || cmd == "quit") {
-			audioRunning = false;
-			controller.join();
+		if (cmd == "exit" || cmd == "quit") {
 			break;
 		}
+		if (!command(tokens, input)) continue;
 
 		while (newProgression) SDL_Delay(16);
 		View::render(progression, (int)(bps * 60.0f));
 	}
 
+	audioRunning = false;
+	controller.join();
+	Control::close();
+	Midi::close();
+	Session::stop();
 	Synth::destroy();
 
 	return 0;